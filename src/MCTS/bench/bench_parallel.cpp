@@ -0,0 +1,96 @@
+// Scaling benchmark of the shared tree parallel search. The network is
+// replaced by a synthetic evaluator, so the numbers measure the tree itself:
+// selection, virtual loss, expansion and backup under contention. latency_us
+// adds a busy wait per evaluated batch to mimic the cost of a network call.
+// movegen/sim counts the legal move generations of the search per simulation,
+// in builds configured with -DMOVEGEN_STATS=ON, and is 0 otherwise.
+//
+// usage: bench_parallel [simulations] [batch_size] [latency_us]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "chess/chess.hpp"
+#include "board_utils.h"
+#include "config.h"
+#include "evaluator.h"
+#include "mcts.h"
+
+namespace {
+
+// Legal moves with pseudo random priors and a small value, derived from the hash of the position.
+class synthetic_evaluator_t : public evaluator_t
+{
+public:
+    explicit synthetic_evaluator_t(int latency_us) : latency_us(latency_us) {}
+
+    void evaluate(std::vector<evaluation_t>& batch) override {
+        auto start = std::chrono::steady_clock::now();
+        for (auto& evaluation : batch) {
+            auto hash = evaluation.key;
+            evaluation.action_probs.clear();
+            for (const auto& move : evaluation.moves) {
+                auto mixed = (hash ^ (static_cast<uint64_t>(move.move()) * 0x9E3779B97F4A7C15ull)) >> 40;
+                evaluation.action_probs.emplace_back(move, 0.1f + static_cast<float>(mixed % 1000) / 1000.0f);
+            }
+            evaluation.value = static_cast<float>(static_cast<int>(hash % 401) - 200) / 1000.0f;
+        }
+        while (std::chrono::steady_clock::now() - start < std::chrono::microseconds(latency_us)) {
+        }
+    }
+
+private:
+    int latency_us;
+};
+
+struct result_t
+{
+    double rate;
+    double movegen_per_simulation;
+};
+
+result_t bench(int threads, int simulations, int batch_size, int latency_us) {
+    config::Config::MCTSConfig mcts_config;
+    mcts_config.num_simulations = simulations;
+    mcts_config.search_batch_size = batch_size;
+    mcts_config.search_threads = threads;
+    mcts_config.reuse_tree = false;
+    MCTS mcts(nullptr, mcts_config, std::make_shared<synthetic_evaluator_t>(latency_us));
+    chess::Board board("r1bqkb1r/pppp1ppp/2n2n2/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4");
+
+#ifdef MOVEGEN_STATS
+    auto movegen_start = utils::movegen_count();
+#endif
+    auto start = std::chrono::steady_clock::now();
+    auto& tree = mcts.search(board, 1);
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double visits = tree[tree.root()].visit_count;
+    double movegen_per_simulation = 0;
+#ifdef MOVEGEN_STATS
+    movegen_per_simulation = (utils::movegen_count() - movegen_start) / visits;
+#endif
+    return {visits / elapsed, movegen_per_simulation};
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int simulations = argc > 1 ? std::atoi(argv[1]) : 20000;
+    int batch_size = argc > 2 ? std::atoi(argv[2]) : 8;
+    int latency_us = argc > 3 ? std::atoi(argv[3]) : 0;
+
+    std::printf("simulations: %d, batch size: %d, latency: %d us\n", simulations, batch_size, latency_us);
+    std::printf("%8s %14s %8s %12s\n", "threads", "sims/s", "speedup", "movegen/sim");
+    double single = 0;
+    for (int threads : {1, 2, 4, 8, 16}) {
+        auto result = bench(threads, simulations, batch_size, latency_us);
+        if (threads == 1) {
+            single = result.rate;
+        }
+        std::printf("%8d %14.0f %7.2fx %12.2f\n", threads, result.rate, result.rate / single, result.movegen_per_simulation);
+    }
+    return 0;
+}
@@ -0,0 +1,78 @@
+// Microbenchmark of the PUCT child selection kernels on realistic branching factors.
+//
+// usage: bench_puct [iterations]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "puct.h"
+
+namespace {
+
+struct children_t {
+    std::vector<float> priors;
+    std::vector<int> visits;
+    std::vector<float> values;
+};
+
+// a node from the middle of a search, visits follow the priors roughly
+std::vector<children_t> make_nodes(int branching_factor, int num_nodes, std::mt19937& gen) {
+    std::gamma_distribution<float> prior_dist(0.3, 1.0);
+    std::uniform_real_distribution<float> q_dist(-1.0, 1.0);
+    std::vector<children_t> nodes(num_nodes);
+    for (auto& node : nodes) {
+        float sum = 0;
+        for (int i = 0; i < branching_factor; ++i) {
+            node.priors.push_back(prior_dist(gen) + 1e-6f);
+            sum += node.priors.back();
+        }
+        for (int i = 0; i < branching_factor; ++i) {
+            node.priors[i] /= sum;
+            int visits = static_cast<int>(node.priors[i] * 400);
+            node.visits.push_back(visits);
+            node.values.push_back(visits * q_dist(gen));
+        }
+    }
+    return nodes;
+}
+
+double bench(puct::select_t select, const std::vector<children_t>& nodes, int iterations, long& checksum) {
+    float exploration = std::sqrt(400.0f);
+    auto start = std::chrono::steady_clock::now();
+    for (int it = 0; it < iterations; ++it) {
+        for (auto& node : nodes) {
+            checksum += select(node.priors.data(), node.visits.data(), node.values.data(), node.priors.size(), exploration, 0.5f);
+        }
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return elapsed / (static_cast<double>(iterations) * nodes.size());
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 2000;
+    std::mt19937 gen(1234);
+    long checksum = 0;
+
+    std::printf("avx2 kernel: %s\n", puct::has_avx2() ? "available" : "not available");
+    std::printf("%10s %14s %14s %14s %8s\n", "children", "scalar ns", "avx2 ns", "dispatch ns", "speedup");
+    for (int branching_factor : {20, 30, 35, 40, 50, 60}) {
+        auto nodes = make_nodes(branching_factor, 256, gen);
+        double scalar = bench(puct::select_scalar, nodes, iterations, checksum);
+        double avx2 = 0;
+#ifdef PUCT_HAS_AVX2_KERNEL
+        if (puct::has_avx2()) {
+            avx2 = bench(puct::select_avx2, nodes, iterations, checksum);
+        }
+#endif
+        double dispatch = bench(puct::select_best, nodes, iterations, checksum);
+        std::printf("%10d %14.2f %14.2f %14.2f %7.2fx\n", branching_factor, scalar, avx2, dispatch, scalar / dispatch);
+    }
+    std::printf("checksum: %ld\n", checksum);
+    return 0;
+}
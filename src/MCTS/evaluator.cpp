@@ -0,0 +1,48 @@
+#include "evaluator.h"
+#include <future>
+#include <mutex>
+#include "string_utils.h"
+#include "trainer.h"
+
+std::string evaluation_key(const chess::Board& board) {
+    auto fen = split(board.getFen(), " ");
+    std::string fen_without_fullmove;
+    for(int i = 0; i < 5; i++) {
+        fen_without_fullmove += fen[i] + " ";
+    }
+    return fen_without_fullmove.substr(0, fen_without_fullmove.size() - 1);
+}
+
+bool memory_evaluator_t::probe(const chess::Board& board, evaluation_t& evaluation) {
+    auto& memory_instance = memory::getInstance();
+    evaluation.key = board.hash();
+    std::unique_lock<std::mutex> lock(memory_instance.transposition_table_mutex);
+    return memory_instance.transposition_table.probe(evaluation.key, evaluation.moves, evaluation.action_probs, evaluation.value);
+}
+
+void memory_evaluator_t::evaluate(std::vector<evaluation_t>& batch) {
+    auto& memory_instance = memory::getInstance();
+
+    std::vector<size_t> missing;
+    {
+        std::unique_lock<std::mutex> lock(memory_instance.transposition_table_mutex);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            // the table returns the priors in move generation order
+            if (!memory_instance.transposition_table.probe(batch[i].key, batch[i].moves, batch[i].action_probs, batch[i].value)) {
+                missing.push_back(i);
+            }
+        }
+    }
+
+    // every position of the batch is queued before waiting, so the model thread sees them together
+    std::vector<std::shared_future<inference_result_t>> results;
+    results.reserve(missing.size());
+    for (auto i : missing) {
+        results.push_back(memory_instance.inference_queue.submit(batch[i].key, batch[i].fen, batch[i].moves));
+    }
+    for (size_t j = 0; j < missing.size(); ++j) {
+        auto& result = results[j].get();
+        batch[missing[j]].action_probs = result.action_probs;
+        batch[missing[j]].value = result.value;
+    }
+}
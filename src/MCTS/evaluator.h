@@ -0,0 +1,50 @@
+#include "chess/chess.hpp"
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+#ifndef MCTS_EVALUATOR_H
+#define MCTS_EVALUATOR_H
+
+// A position waiting for the network, key is its Zobrist hash. moves are the
+// legal moves of the position, generated once by the search when it reaches
+// the leaf, so neither the evaluator nor the model generates them again. The
+// evaluator fills action_probs with the prior of every legal move and value
+// with the value of the position for the side to move.
+struct evaluation_t
+{
+    uint64_t key = 0;
+    std::string fen;
+    chess::Movelist moves;
+    std::vector<std::pair<chess::Move, float>> action_probs;
+    float value = 0.0;
+};
+
+class evaluator_t
+{
+public:
+    virtual ~evaluator_t() = default;
+
+    // Fills evaluation from a cache without blocking, false if the position is not cached.
+    // evaluation.moves holds the legal moves of board.
+    virtual bool probe(const chess::Board& board, evaluation_t& evaluation) { return false; }
+
+    // Evaluates the whole batch, blocks until every position is computed.
+    virtual void evaluate(std::vector<evaluation_t>& batch) = 0;
+};
+
+// Evaluates positions through the transposition table of memory, misses are
+// queued for the trainer's model thread.
+class memory_evaluator_t : public evaluator_t
+{
+public:
+    bool probe(const chess::Board& board, evaluation_t& evaluation) override;
+    void evaluate(std::vector<evaluation_t>& batch) override;
+};
+
+// The FEN sent to the model thread, without the fullmove counter.
+std::string evaluation_key(const chess::Board& board);
+
+#endif // MCTS_EVALUATOR_H
@@ -1,48 +1,589 @@
 
 #include "mcts.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
 #include <memory>
+#include <numeric>
+#include <thread>
 #include <vector>
 #include <torch/torch.h>
 #include <chess/chess.hpp>
 #include <logger.h>
 #include <board_utils.h>
+#include <random.h>
 #include <string_utils.h>
 
+namespace {
 
-MCTS::MCTS(std::shared_ptr<torch::nn::Module> model, const config::Config::MCTSConfig& config){
+// simulations of one parallel round, the tree buffers are sized for a round before the threads start
+constexpr unsigned int PARALLEL_ROUND_SIZE = 1024;
+
+} // namespace
+
+MCTS::MCTS(
+    std::shared_ptr<torch::nn::Module> model,
+    const config::Config::MCTSConfig& config,
+    std::shared_ptr<evaluator_t> evaluator
+){
     this->model = model;
-    this->num_simulations = config.num_simulations;
-    this->c_puct = config.exploration_constant;
+    this->evaluator = evaluator;
+    this->config = config;
+    this->search_batch_size = std::max(1, config.search_batch_size);
+    this->search_threads = std::max(1, config.search_threads);
+    this->reuse_tree = config.reuse_tree;
+    this->early_stop = config.early_stop;
+    this->early_stop_kl_threshold = config.early_stop_kl_threshold;
+    this->kl_check_interval = std::max(1, config.kl_check_interval);
+    this->tree.set_graph(config.graph_search);
+    this->tree.set_solver(config.solver);
+    search_params_t params;
+    params.c_puct = config.exploration_constant;
+    params.c_puct_base = config.c_puct_base;
+    params.c_puct_factor = config.c_puct_factor;
+    params.fpu_absolute = config.fpu_strategy == "absolute";
+    params.fpu_value = config.fpu_value;
+    params.fpu_reduction = config.fpu_reduction;
+    params.fpu_reduction_root = config.fpu_reduction_root;
+    this->tree.set_params(params);
+    if (config.graph_search && this->search_threads > 1) {
+        Logger::log("Graph search runs on a single thread, ignoring search_threads");
+        this->search_threads = 1;
+    }
+    if (config.root_selection == "gumbel" && this->search_threads > 1) {
+        Logger::log("The Gumbel root runs on a single thread, ignoring search_threads");
+        this->search_threads = 1;
+    }
+}
+
+search_tree_t& MCTS::search(const chess::Board& board, int iteration, bool full_search)
+{
+    begin_search(board, iteration, full_search);
+    run_search();
+    return end_search();
+}
+
+void MCTS::begin_search(const chess::Board& board, int iteration, bool full_search)
+{
+    this->start = std::chrono::steady_clock::now();
+    this->deadline = this->config.max_time_ms > 0 ?
+        this->start + std::chrono::milliseconds(this->config.max_time_ms) : std::chrono::steady_clock::time_point::max();
+    this->target_ms = 0;
+    // new simulations, the visits kept from the previous search come on top
+    prepare(board, std::max(0, full_search ? this->config.simulations(iteration) : this->config.fast_simulations));
+}
+
+search_tree_t& MCTS::search(const chess::Board& board, const time_control_t& time_control)
+{
+    this->start = std::chrono::steady_clock::now();
+    float hard_ms;
+    if (time_control.move_time_ms > 0) {
+        // the move time is a hard limit, clear positions stop well before it
+        hard_ms = time_control.move_time_ms;
+        this->target_ms = hard_ms / this->config.time_max_factor;
+    } else {
+        float available_ms = std::max(0, time_control.remaining_ms - this->config.move_overhead_ms);
+        this->target_ms = available_ms / std::max(1, this->config.time_moves_to_go) + time_control.increment_ms;
+        hard_ms = std::min(this->target_ms * this->config.time_max_factor, available_ms);
+    }
+    // 0 would mean a search bounded by simulations
+    this->target_ms = std::max(this->target_ms, 1e-3f);
+    this->deadline = this->start + std::chrono::microseconds(static_cast<int64_t>(hard_ms * 1000));
+    prepare(board, std::numeric_limits<int>::max());
+    run_search();
+    return end_search();
 }
 
-std::shared_ptr<node_t> MCTS::search(const chess::Board& board, int iteration)
+void MCTS::prepare(const chess::Board& board, unsigned int budget)
 {
-    chess::Board board_copy = chess::Board(board); 
-    auto root = std::make_shared<node_t>(board_copy, this->model);
-    for (unsigned int i = 0; i < iteration * this->num_simulations; ++i) {
-        // Logger::log("Simulation " + std::to_string(i));
-        root->board = chess::Board(board);
-        auto game_result = root->board.isGameOver(); // DRAW, LOSE, NONE
-        if(game_result.second != chess::GameResult::NONE) {
-            Logger::log("Game Over");
+    if (!this->tree_kept || this->worker.board.hash() != board.hash()) {
+        // drops the tree of the previous move, the arena keeps its memory
+        this->tree.reset();
+    }
+    this->tree_kept = false;
+    // the only board copy of the search
+    this->worker.board = board;
+    this->kept_visits = this->tree[this->tree.root()].visit_count;
+    // the budget is a target for the root visits, so a reused subtree still gets
+    // budget new simulations, a fast search included
+    this->search_budget = budget + std::min(this->kept_visits, std::numeric_limits<unsigned int>::max() - budget);
+    this->search_stopped = false;
+    this->stats.garbage_collections = 0;
+    this->kl_checkpoint.clear();
+    this->next_kl_check = this->kept_visits + this->kl_check_interval;
+}
+
+void MCTS::run_search()
+{
+    // sequential halving needs a simulation budget, time managed searches keep PUCT at the root
+    if (this->config.root_selection == "gumbel" && this->target_ms <= 0) {
+        this->search_stopped = search_gumbel(this->search_budget);
+    } else if (this->search_threads > 1) {
+        this->search_stopped = search_parallel(this->search_budget);
+    } else {
+        while (!search_done()) {
+            auto& batch = gather_batch();
+            if (!batch.empty()) {
+                this->evaluator->evaluate(batch);
+            }
+            apply_batch();
+        }
+    }
+}
+
+bool MCTS::search_done() {
+    if (this->tree[this->tree.root()].visit_count >= this->search_budget) {
+        return true;
+    }
+    if (root_solved(this->search_stopped) || limits_reached()) {
+        return true;
+    }
+    if (should_stop(this->search_budget)) {
+        this->search_stopped = true;
+        return true;
+    }
+    return false;
+}
+
+std::vector<evaluation_t>& MCTS::gather_batch() {
+    collect_garbage();
+    unsigned int remaining = this->search_budget - this->tree[this->tree.root()].visit_count;
+    gather_leaves(this->tree, this->worker, std::min(remaining, this->search_batch_size));
+    return this->worker.batch;
+}
+
+void MCTS::apply_batch() {
+    apply_evaluations(this->tree, this->worker);
+}
+
+search_tree_t& MCTS::end_search() {
+    unsigned int visits = this->tree[this->tree.root()].visit_count;
+    this->stats.simulations = visits - std::min(visits, this->kept_visits);
+    // a time managed search has no simulation budget to save
+    bool saved = this->search_stopped && this->target_ms <= 0;
+    this->stats.saved_simulations = saved ? this->search_budget - std::min(visits, this->search_budget) : 0;
+    return this->tree;
+}
+
+bool MCTS::root_solved(bool& stopped) {
+    auto root = this->tree.root();
+    if (!this->tree.terminal_value(root, this->worker.board).has_value()) {
+        return false;
+    }
+    if (this->tree[root].is_expanded()) {
+        // proven by the solver, more simulations cannot change the result
+        stopped = true;
+    } else {
+        Logger::log("Game Over");
+    }
+    return true;
+}
+
+bool MCTS::limits_reached() const {
+    if (this->config.max_nodes > 0 && this->tree.size() >= static_cast<size_t>(this->config.max_nodes)) {
+        return true;
+    }
+    auto& root = this->tree[this->tree.root()];
+    if (this->target_ms > 0 && !root.is_expanded()) {
+        // a time managed search always has a move to play, even out of time
+        return false;
+    }
+    // one clock read per batch, the entropy is only computed once the minimum time is used
+    auto now = std::chrono::steady_clock::now();
+    if (now >= this->deadline) {
+        return true;
+    }
+    if (this->target_ms <= 0) {
+        return false;
+    }
+    if (root.num_edges == 1) {
+        // a forced move needs no time at all
+        return true;
+    }
+    float elapsed_ms = std::chrono::duration<float, std::milli>(now - this->start).count();
+    float min_factor = this->config.time_min_factor;
+    if (elapsed_ms < this->target_ms * min_factor) {
+        return false;
+    }
+    // visits spread over many moves mean an unclear position, which gets more time
+    float factor = min_factor + (this->config.time_max_factor - min_factor) * root_entropy();
+    return elapsed_ms >= this->target_ms * factor;
+}
+
+void MCTS::collect_garbage() {
+    if (this->config.max_tree_bytes == 0 || this->tree.memory_usage() < this->config.max_tree_bytes) {
+        return;
+    }
+    // a parallel search keeps the tree concurrent between rounds, the copy needs it compact
+    this->tree.end_concurrent();
+    this->tree.collect_garbage(static_cast<size_t>(this->config.max_tree_bytes * this->config.gc_keep_fraction));
+    this->stats.garbage_collections++;
+}
+
+float MCTS::root_entropy() const {
+    auto& root = this->tree[this->tree.root()];
+    // helpers may still be backing up, every count is loaded once
+    std::vector<int> edge_visits(root.num_edges);
+    int visits = 0;
+    for (uint32_t i = 0; i < root.num_edges; ++i) {
+        edge_visits[i] = load_relaxed(this->tree.edges.visits[root.first_edge + i]);
+        visits += edge_visits[i];
+    }
+    if (visits == 0 || root.num_edges < 2) {
+        return 0;
+    }
+    float entropy = 0;
+    for (int edge_visit : edge_visits) {
+        if (edge_visit > 0) {
+            float p = static_cast<float>(edge_visit) / visits;
+            entropy -= p * std::log(p);
+        }
+    }
+    return entropy / std::log(static_cast<float>(root.num_edges));
+}
+
+bool MCTS::should_stop(unsigned int budget) {
+    auto& root = this->tree[this->tree.root()];
+    if (!this->early_stop || !root.is_expanded()) {
+        return false;
+    }
+    // helpers may still be backing up, the counters are loaded atomically
+    unsigned int root_visits = root.get_visit_count();
+    if (root_visits >= budget) {
+        return false;
+    }
+    unsigned int remaining = budget - root_visits;
+    std::vector<int> edge_visits(root.num_edges);
+    int leader = 0;
+    int runner_up = 0;
+    for (uint32_t i = 0; i < root.num_edges; ++i) {
+        int visits = load_relaxed(this->tree.edges.visits[root.first_edge + i]);
+        edge_visits[i] = visits;
+        if (visits > leader) {
+            runner_up = leader;
+            leader = visits;
+        } else if (visits > runner_up) {
+            runner_up = visits;
+        }
+    }
+    // no other move can catch up with the leader, even with all the remaining simulations
+    if (root.num_edges == 1 || leader - runner_up > static_cast<int>(remaining)) {
+        return true;
+    }
+
+    if (this->early_stop_kl_threshold <= 0 || root_visits < this->next_kl_check) {
+        return false;
+    }
+    this->next_kl_check = root_visits + this->kl_check_interval;
+    std::vector<float> distribution(root.num_edges);
+    for (uint32_t i = 0; i < root.num_edges; ++i) {
+        distribution[i] = static_cast<float>(edge_visits[i]) / root_visits;
+    }
+    bool converged = false;
+    if (this->kl_checkpoint.size() == distribution.size()) {
+        // KL(current || checkpoint), smoothed for moves the checkpoint had not visited
+        constexpr float epsilon = 1e-6;
+        float kl = 0;
+        for (size_t i = 0; i < distribution.size(); ++i) {
+            if (distribution[i] > 0) {
+                kl += distribution[i] * std::log(distribution[i] / std::max(this->kl_checkpoint[i], epsilon));
+            }
+        }
+        converged = kl < this->early_stop_kl_threshold;
+    }
+    this->kl_checkpoint = std::move(distribution);
+    return converged;
+}
+
+bool MCTS::search_parallel(unsigned int budget) {
+    this->helpers.resize(this->search_threads - 1);
+    for (auto& helper : this->helpers) {
+        helper.board = this->worker.board;
+    }
+    bool stopped = false;
+    while (this->tree[this->tree.root()].visit_count < budget && !stopped) {
+        if (root_solved(stopped)) {
+            break;
+        }
+        if (limits_reached()) {
+            break;
+        }
+        if (should_stop(budget)) {
+            stopped = true;
+            break;
+        }
+        // a round may overshoot the memory budget by its own expansions
+        collect_garbage();
+        unsigned int round = std::min(budget - this->tree[this->tree.root()].visit_count, PARALLEL_ROUND_SIZE);
+        // every simulation expands at most one node, losing a race for a child wastes at most one node per thread.
+        // The tree stays concurrent until the search ends, later rounds reuse the spare slots
+        this->tree.begin_concurrent(
+            static_cast<size_t>(round) * this->search_threads,
+            static_cast<size_t>(round) * chess::constants::MAX_MOVES
+        );
+        std::atomic<int> quota(round);
+        std::atomic<bool> stop(false);
+        auto run = [this, &quota, &stop, budget](search_worker_t& worker) {
+            int left = quota.load();
+            while (true) {
+                if (this->tree[this->tree.root()].is_proven()) {
+                    // the solver proved the root during this round
+                    stop = true;
+                    quota = 0;
+                    return;
+                }
+                // only the calling thread checks, it owns the KL checkpoint
+                if (&worker == &this->worker) {
+                    bool limited = limits_reached();
+                    if (limited || should_stop(budget)) {
+                        stop = !limited;
+                        quota = 0;
+                        return;
+                    }
+                }
+                int batch_size;
+                do {
+                    if (left <= 0) {
+                        return;
+                    }
+                    batch_size = std::min(static_cast<int>(this->search_batch_size), left);
+                } while (!quota.compare_exchange_weak(left, left - batch_size));
+                int done = simulate(this->tree, worker, batch_size);
+                if (done < batch_size) {
+                    // simulations lost to collisions go back to the round
+                    quota.fetch_add(batch_size - done);
+                    if (done == 0) {
+                        std::this_thread::yield();
+                    }
+                }
+                left = quota.load();
+            }
+        };
+        std::vector<std::thread> threads;
+        for (auto& helper : this->helpers) {
+            threads.emplace_back(run, std::ref(helper));
+        }
+        run(this->worker);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        stopped = stop;
+    }
+    this->tree.end_concurrent();
+    return stopped;
+}
+
+// Gumbel MuZero root (Danihelka et al., Policy improvement by planning with
+// Gumbel): the top k root moves by g + logits, with g sampled from a Gumbel
+// distribution, share the budget by sequential halving. Every phase splits its
+// share of the budget evenly between the remaining moves and keeps the better
+// half by g + logits + sigma(q). The surviving move is played and the policy
+// target is softmax(logits + sigma(q)), unvisited moves take the root value as
+// q. Below the root the descent stays PUCT and early_stop is not used.
+bool MCTS::search_gumbel(unsigned int budget) {
+    auto root = this->tree.root();
+    bool stopped = false;
+    // the priors of the root are needed before any move can be sampled
+    while (!this->tree[root].is_expanded() && this->tree[root].visit_count < budget) {
+        if (root_solved(stopped) || limits_reached()) {
+            return stopped;
+        }
+        simulate(this->tree, this->worker, 1);
+    }
+    if (!this->tree[root].is_expanded()) {
+        return false;
+    }
+    auto first = this->tree[root].first_edge;
+    int count = static_cast<int>(this->tree[root].num_edges);
+    auto& edges = this->tree.edges;
+
+    std::vector<float> logits(count);
+    std::vector<float> perturbed(count);
+    for (int i = 0; i < count; ++i) {
+        logits[i] = std::log(std::max(edges.priors[first + i], std::numeric_limits<float>::min()));
+        perturbed[i] = utils::random_gumbel() + logits[i];
+    }
+    // sigma of the completed q of every root move, q in [0, 1] for the side to move at the root
+    std::vector<float> sigma(count);
+    auto update_sigma = [&]() {
+        auto& node = this->tree[root];
+        float root_q = node.visit_count > 0 ? (node.value / node.visit_count + 1) / 2 : 0.5f;
+        int max_visits = *std::max_element(&edges.visits[first], &edges.visits[first] + count);
+        float scale = (this->config.gumbel_c_visit + max_visits) * this->config.gumbel_c_scale;
+        for (int i = 0; i < count; ++i) {
+            int visits = edges.visits[first + i];
+            float q = visits == 0 ? root_q : 1 - (edges.values[first + i] / visits + 1) / 2;
+            sigma[i] = scale * q;
+        }
+    };
+
+    std::vector<int> candidates(count);
+    std::iota(candidates.begin(), candidates.end(), 0);
+    auto by_perturbed = [&](int a, int b) { return perturbed[a] > perturbed[b]; };
+    auto top_k = std::min(count, std::max(1, this->config.gumbel_top_k));
+    std::partial_sort(candidates.begin(), candidates.begin() + top_k, candidates.end(), by_perturbed);
+    candidates.resize(top_k);
+
+    // a single move still takes the whole budget, its subtree is the next root
+    int phases = std::max(1, static_cast<int>(std::ceil(std::log2(top_k))));
+    bool running = true;
+    for (int phase = 0; phase < phases && running; ++phase) {
+        unsigned int visits = this->tree[root].visit_count;
+        unsigned int phase_budget = (budget > visits ? budget - visits : 0) / (phases - phase);
+        for (size_t i = 0; i < candidates.size() && running; ++i) {
+            unsigned int share = phase_budget / candidates.size() + (i < phase_budget % candidates.size());
+            running = visit_root_edge(first + candidates[i], share, stopped);
+        }
+        update_sigma();
+        std::stable_sort(candidates.begin(), candidates.end(), [&](int a, int b) {
+            return perturbed[a] + sigma[a] > perturbed[b] + sigma[b];
+        });
+        candidates.resize((candidates.size() + 1) / 2);
+    }
+    // a budget too small for a single phase still plays the best sampled move
+    update_sigma();
+    auto action = *std::max_element(candidates.begin(), candidates.end(), [&](int a, int b) {
+        return perturbed[a] + sigma[a] < perturbed[b] + sigma[b];
+    });
+
+    std::vector<float> policy(count);
+    float max_logit = -std::numeric_limits<float>::infinity();
+    for (int i = 0; i < count; ++i) {
+        policy[i] = logits[i] + sigma[i];
+        max_logit = std::max(max_logit, policy[i]);
+    }
+    float sum = 0;
+    for (auto& prob : policy) {
+        prob = std::exp(prob - max_logit);
+        sum += prob;
+    }
+    for (auto& prob : policy) {
+        prob /= sum;
+    }
+    this->tree.set_root_policy(first + action, std::move(policy));
+    return stopped;
+}
+
+bool MCTS::visit_root_edge(edge_index_t edge, unsigned int simulations, bool& stopped) {
+    this->worker.root_edge = edge;
+    unsigned int done = 0;
+    bool running = true;
+    while (done < simulations) {
+        if (root_solved(stopped) || limits_reached()) {
+            running = false;
             break;
         }
-        simulate(root);
+        int gathered = simulate(this->tree, this->worker, std::min(simulations - done, this->search_batch_size));
+        if (gathered == 0) {
+            // no leaf could be gathered below the edge, the rest of its share would never be used
+            break;
+        }
+        done += gathered;
+    }
+    this->worker.root_edge = NULL_EDGE;
+    return running;
+}
+
+int MCTS::simulate(search_tree_t& tree, search_worker_t& worker, int batch_size) {
+    if (tree.terminal_value(tree.root(), worker.board).has_value()) {
+        return 0;
+    }
+    int gathered = gather_leaves(tree, worker, batch_size);
+    if (!worker.batch.empty()) {
+        this->evaluator->evaluate(worker.batch);
+    }
+    apply_evaluations(tree, worker);
+    return gathered;
+}
+
+int MCTS::gather_leaves(search_tree_t& tree, search_worker_t& worker, int count) {
+    worker.pending.clear();
+    worker.batch.clear();
+    while (static_cast<int>(worker.pending.size()) < count) {
+        auto& leaf = worker.pending.emplace_back();
+        auto node = tree.select_best_leaf(worker.board, leaf.path, worker.root_edge);
+        if (leaf.path.terminal) {
+            // a graph descent drew by repetition or the 50 move rule at a shared node
+            leaf.value = 0.0;
+        } else if (tree[node].is_proven()) {
+            // terminal or proven by the solver, the value is exact
+            leaf.value = tree.terminal_value(node, worker.board).value();
+        } else if (tree[node].is_expanded()) {
+            // the descent hit MAX_DEPTH, back up the current estimate of the node
+            leaf.value = tree[node].get_value() / tree[node].get_visit_count();
+        } else {
+            // the only move generation of the leaf, shared by the terminal check, the
+            // cache and the evaluator, a leaf claimed by someone else is not terminal
+            auto& moves = worker.cached.moves;
+            std::optional<float> terminal;
+            bool claimed = tree[node].is_claimed();
+            if (!claimed) {
+                utils::legal_moves(moves, worker.board);
+                terminal = tree.terminal_value(node, worker.board, moves);
+            }
+            if (terminal.has_value()) {
+                leaf.value = terminal.value();
+            } else if (claimed || !tree.try_claim(node)) {
+                // the leaf is already pending in this batch or being evaluated by another
+                // worker, virtual loss no longer steers the descent away, send what we have
+                tree.undo_moves(leaf.path, worker.board);
+                worker.pending.pop_back();
+                break;
+            } else if (this->evaluator->probe(worker.board, worker.cached)) {
+                // cache hits are expanded right away and never reach the batch
+                leaf.value = tree.expand(node, worker.cached);
+            } else {
+                leaf.evaluation = static_cast<int>(worker.batch.size());
+                auto& evaluation = worker.batch.emplace_back();
+                evaluation.key = worker.board.hash();
+                evaluation.fen = evaluation_key(worker.board);
+                evaluation.moves = moves;
+            }
+        }
+        // makes the next descents of this batch prefer other paths
+        tree.add_virtual_loss(leaf.path, 1);
+        tree.undo_moves(leaf.path, worker.board);
+    }
+    return static_cast<int>(worker.pending.size());
+}
+
+void MCTS::apply_evaluations(search_tree_t& tree, search_worker_t& worker) {
+    // all of the batch's virtual loss is gone before the first backup, graph
+    // mode overwrites edge values and would otherwise lose the outstanding one
+    for (auto& leaf : worker.pending) {
+        tree.add_virtual_loss(leaf.path, -1);
+    }
+    for (auto& leaf : worker.pending) {
+        float value = leaf.value;
+        if (leaf.evaluation >= 0) {
+            value = tree.expand(leaf.path.leaf, worker.batch[leaf.evaluation]);
+        }
+        // Logger::log("Value to backpropagate: " + to_string(value));
+        tree.backpropagate(leaf.path, value);
     }
-    return root;
+    worker.pending.clear();
 }
 
-void MCTS::simulate(std::shared_ptr<node_t> root) {
-    auto game_result = root->board.isGameOver(); // DRAW, LOSE, NONE
-    if(game_result.second != chess::GameResult::NONE) {
-        return; // std::make_shared<HistoryObject>(utils::board_to_tensor(root->board), torch::zeros({1, 8, 8}), 0.0, game_result.second);
+void MCTS::advance(chess::Move move) {
+    this->tree_kept = false;
+    if (!this->reuse_tree) {
+        return;
+    }
+    auto& root = this->tree[this->tree.root()];
+    for (edge_index_t edge = root.first_edge; edge < root.first_edge + root.num_edges; ++edge) {
+        if (this->tree.edges.moves[edge] != move) {
+            continue;
+        }
+        auto child = this->tree.edges.children[edge];
+        if (child != NULL_NODE) {
+            // the siblings of the played move are dropped with the old buffers
+            this->tree.reroot(child);
+            this->worker.board.makeMove(move);
+            this->tree_kept = true;
+        }
+        return;
     }
-    auto node = root->select_best_leaf();
-    auto value = node->expand();
-    // Logger::log("Value to backpropagate: " + to_string(value));
-    // Logger::log("Value before backpropagate: " + to_string(root->value));
-    node->backpropagate(value);
-    // Logger::log("Value after backpropagate: " + to_string(root->value));
 }
 
 void MCTS::set_model(std::shared_ptr<torch::nn::Module> model)
@@ -1,9 +1,11 @@
 
+#include <chrono>
 #include <memory>
 #include <torch/torch.h>
 #include <vector>
 #include "model.h"
 #include "node.h"
+#include "evaluator.h"
 #include "chess/chess.hpp"
 #include "config.h"
 
@@ -22,16 +24,131 @@ struct HistoryObject
     HistoryObject(torch::Tensor state, torch::Tensor action_prob, float value, chess::GameResult result) : state(state), action_prob(action_prob), value(value), result(result) {}
 };
 
+// A leaf selected for the current batch. evaluation is its index in the
+// worker's batch, or -1 when its value is already known (terminal position or
+// depth limit) and stored in value.
+struct pending_leaf_t
+{
+    search_path_t path;
+    int evaluation = -1;
+    float value = 0.0;
+};
+
+// Per-thread state of a descent. The board starts at the root position, a
+// simulation plays the selected moves on it and takes them back afterwards,
+// so simulations never copy a board. The pending leaves and the batch sent
+// to the evaluator are reused from one batch to the next.
+struct search_worker_t
+{
+    chess::Board board;
+    search_path_t path;
+    std::vector<pending_leaf_t> pending;
+    std::vector<evaluation_t> batch;
+    // receives cache hits, which are expanded without waiting for the batch
+    evaluation_t cached;
+    // the root move every descent starts with, NULL_EDGE lets PUCT choose
+    edge_index_t root_edge = NULL_EDGE;
+};
+
+// The wall clock budget of a time managed search: a fixed time per move, or
+// the remaining clock of the side to move and its increment.
+struct time_control_t
+{
+    int move_time_ms = 0;
+    int remaining_ms = 0;
+    int increment_ms = 0;
+};
+
+// What the last search did with its budget.
+struct search_stats_t
+{
+    // simulations run by the search, visits kept from the previous move excluded
+    unsigned int simulations = 0;
+    // simulations of the budget left unused because the search stopped early
+    unsigned int saved_simulations = 0;
+    // times the tree hit max_tree_bytes and was pruned
+    unsigned int garbage_collections = 0;
+};
+
 class MCTS
 {
 private:
-    unsigned int num_simulations;
-    float c_puct;
+    // simulation schedule and search limits
+    config::Config::MCTSConfig config;
+    std::chrono::steady_clock::time_point start;
+    // hard time limit of the search, time_point::max() when there is none
+    std::chrono::steady_clock::time_point deadline;
+    // target time of a time managed search, 0 when the search is bounded by simulations
+    float target_ms = 0;
+    // state of the current search, set by prepare()
+    unsigned int search_budget = 0;
+    unsigned int kept_visits = 0;
+    bool search_stopped = false;
+    unsigned int search_batch_size;
+    unsigned int search_threads;
+    bool reuse_tree;
+    bool early_stop;
+    float early_stop_kl_threshold;
+    unsigned int kl_check_interval;
+    // root visit distribution at the last KL checkpoint of the current search
+    std::vector<float> kl_checkpoint;
+    unsigned int next_kl_check = 0;
+    search_stats_t stats;
+    // set by advance() when the tree already holds the subtree of the next position
+    bool tree_kept = false;
+    search_tree_t tree;
+    search_worker_t worker;
+    // the workers of the other threads when search_threads > 1
+    std::vector<search_worker_t> helpers;
+    std::shared_ptr<evaluator_t> evaluator;
+
+    // resets or keeps the tree for board, budget is the number of new simulations
+    void prepare(const chess::Board& board, unsigned int budget);
+    void run_search();
+    // true if the search stopped early
+    bool search_parallel(unsigned int budget);
+    bool search_gumbel(unsigned int budget);
+    // runs simulations through one root edge, false once the search has to end
+    bool visit_root_edge(edge_index_t edge, unsigned int simulations, bool& stopped);
+    bool should_stop(unsigned int budget);
+    // true once the root is terminal or proven, stopped is set when the latter saves simulations
+    bool root_solved(bool& stopped);
+    // true once the node or time limit of the search is reached
+    bool limits_reached() const;
+    // entropy of the root visit distribution, divided by its maximum
+    float root_entropy() const;
+    // prunes the tree once it uses max_tree_bytes
+    void collect_garbage();
+
+    int gather_leaves(search_tree_t& tree, search_worker_t& worker, int count);
+    void apply_evaluations(search_tree_t& tree, search_worker_t& worker);
 public:
-    MCTS(std::shared_ptr<torch::nn::Module> model, const config::Config::MCTSConfig& config);
-    std::shared_ptr<node_t> search(const chess::Board& board, int iteration = 0);
-    void simulate(std::shared_ptr<node_t> root);
-    std::vector<std::pair<chess::Move, float>> _compute_policy(node_t& node);
+    MCTS(
+        std::shared_ptr<torch::nn::Module> model,
+        const config::Config::MCTSConfig& config,
+        std::shared_ptr<evaluator_t> evaluator = std::make_shared<memory_evaluator_t>()
+    );
+    // runs the simulations the schedule gives for the training iteration, or
+    // fast_simulations for a fast search of playout cap randomization
+    search_tree_t& search(const chess::Board& board, int iteration = 0, bool full_search = true);
+    // runs until the time the time control gives this move is used, or the node limit is reached
+    search_tree_t& search(const chess::Board& board, const time_control_t& time_control);
+
+    // The serial search one batch at a time, for callers that evaluate the
+    // leaves of many searches together: begin_search() starts the search,
+    // gather_batch() selects the next leaves and returns the positions to
+    // evaluate, which the caller fills in before apply_batch() backs them up.
+    // The search is over once search_done() is true, end_search() returns its
+    // tree. The root is always selected by PUCT and search_threads is ignored.
+    void begin_search(const chess::Board& board, int iteration = 0, bool full_search = true);
+    bool search_done();
+    std::vector<evaluation_t>& gather_batch();
+    void apply_batch();
+    search_tree_t& end_search();
+    void advance(chess::Move move);
+    const search_stats_t& last_search_stats() const { return stats; }
+    // runs up to batch_size simulations, their leaves are evaluated together
+    int simulate(search_tree_t& tree, search_worker_t& worker, int batch_size = 1);
     void set_model(std::shared_ptr<torch::nn::Module> model);
     ~MCTS();
     std::shared_ptr<torch::nn::Module> model;
@@ -1,165 +1,549 @@
-
+#include <algorithm>
 #include <cmath>
+#include <functional>
 #include <memory>
+#include <thread>
 #include <format>
 #include "random.h"
 #include "node.h"
+#include "puct.h"
 #include "logger.h"
 #include "string_utils.h"
-#include "trainer.h"
 
 node_t::node_t(
-    chess::Board& board,
-    std::shared_ptr<torch::nn::Module> model,
-    std::shared_ptr<node_t> parent,
-    chess::Move move,
-    float prior
-) : board(board),
-    model(model),
-    parent(parent),
-    move(move),
+    node_index_t parent,
+    edge_index_t parent_edge
+) : parent(parent),
+    parent_edge(parent_edge),
+    first_edge(NULL_EDGE),
+    num_edges(0),
     value(0.0),
     visit_count(0),
-    prior(prior) {}
-
-/*
-node_t node_t::operator=(const node_t& node) {
-    this->parent = node.parent;
-    this->move = node.move;
-    this->value = node.value;
-    this->visit_count = node.visit_count;
-    this->prior = node.prior;
-    return *this;
-}
-*/
-
-std::shared_ptr<node_t> node_t::select_best_child() {
-    float best_score = std::numeric_limits<int>::min();
-    std::shared_ptr<node_t> best_child;
-    for(auto child : this->children) {
-        float score = this->ucb_score(child);
-        // Logger::log(join_str(" ", "Child", std::string(child->move.from()), std::string(child->move.to()), "Value", child->value, "Visit Count", child->visit_count, "Score", score));
-        if(score > best_score) {
-            best_score = score;
-            best_child = child;
-        }
+    claimed(0),
+    proof(proof_t::UNKNOWN) {}
+
+namespace {
+
+template <typename T>
+void add_to(T& target, T amount, bool concurrent) {
+    if (concurrent) {
+        std::atomic_ref<T>(target).fetch_add(amount, std::memory_order_relaxed);
+    } else {
+        target += amount;
+    }
+}
+
+float proof_value(proof_t proof) {
+    return proof == proof_t::WIN ? 1.0 : proof == proof_t::DRAW ? 0.0 : -1.0;
+}
+
+void set_proof(node_t& node, proof_t proof) {
+    std::atomic_ref<proof_t>(node.proof).store(proof, std::memory_order_relaxed);
+}
+
+// a child slot reserved by the worker allocating the child, see get_child
+constexpr node_index_t PENDING_NODE = NULL_NODE - 1;
+
+} // namespace
+
+void edges_t::clear() {
+    moves.clear();
+    priors.clear();
+    visits.clear();
+    values.clear();
+    children.clear();
+}
+
+void edges_t::resize(size_t size) {
+    moves.resize(size);
+    priors.resize(size, 0.0);
+    visits.resize(size, 0);
+    values.resize(size, 0.0);
+    children.resize(size, NULL_NODE);
+}
+
+search_tree_t::search_tree_t() {
+    reset();
+}
+
+void search_tree_t::reset() {
+    // nodes and edges are trivially destructible, so clearing is O(1) and keeps the capacity
+    this->nodes.clear();
+    this->edges.clear();
+    this->nodes.emplace_back();
+    this->transpositions.clear();
+    this->root_action = NULL_EDGE;
+    this->root_policy.clear();
+}
+
+void search_tree_t::begin_concurrent(size_t max_new_nodes, size_t max_new_edges) {
+    if (!this->concurrent) {
+        this->node_count = static_cast<uint32_t>(this->nodes.size());
+        this->edge_count = static_cast<uint32_t>(this->edges.size());
+        this->concurrent = true;
+    }
+    // called again between rounds, the buffers only grow when the spare slots run
+    // short, and then by half their size so a long search resizes them a few times
+    size_t nodes_needed = this->node_count + max_new_nodes;
+    if (nodes_needed > this->nodes.size()) {
+        this->nodes.resize(std::max(nodes_needed, this->nodes.size() + this->nodes.size() / 2));
+    }
+    size_t edges_needed = this->edge_count + max_new_edges;
+    if (edges_needed > this->edges.size()) {
+        this->edges.resize(std::max(edges_needed, this->edges.size() + this->edges.size() / 2));
     }
-    return best_child;
 }
 
-std::shared_ptr<node_t> node_t::select_best_leaf() {
-    auto node = shared_from_this();
-    while (node->children.size() > 0) {
-        if (node->board.isGameOver().second != chess::GameResult::NONE) {
-            Logger::log("Maybe segfault saver1");
+void search_tree_t::end_concurrent() {
+    if (!this->concurrent) {
+        return;
+    }
+    // shrinking keeps the capacity for the next search
+    this->nodes.resize(this->node_count);
+    this->edges.resize(this->edge_count);
+    this->concurrent = false;
+}
+
+node_index_t search_tree_t::allocate_node(node_index_t parent, edge_index_t parent_edge) {
+    if (!this->concurrent) {
+        this->nodes.emplace_back(parent, parent_edge);
+        return static_cast<node_index_t>(this->nodes.size() - 1);
+    }
+    auto index = std::atomic_ref<uint32_t>(this->node_count).fetch_add(1, std::memory_order_relaxed);
+    if (index >= this->nodes.size()) {
+        throw std::runtime_error("Search tree is full");
+    }
+    this->nodes[index] = node_t(parent, parent_edge);
+    return index;
+}
+
+edge_index_t search_tree_t::allocate_edges(size_t count) {
+    if (!this->concurrent) {
+        auto first_edge = static_cast<edge_index_t>(this->edges.size());
+        this->edges.resize(first_edge + count);
+        return first_edge;
+    }
+    auto first_edge = std::atomic_ref<uint32_t>(this->edge_count).fetch_add(static_cast<uint32_t>(count), std::memory_order_relaxed);
+    if (first_edge + count > this->edges.size()) {
+        throw std::runtime_error("Search tree is full");
+    }
+    return first_edge;
+}
+
+void search_tree_t::reroot(node_index_t index) {
+    this->copy_subtree(index, 0);
+}
+
+size_t search_tree_t::memory_usage() const {
+    size_t edges = this->concurrent ? std::atomic_ref<uint32_t>(this->edge_count).load(std::memory_order_relaxed) : this->edges.size();
+    return this->size() * sizeof(node_t) + edges * edges_t::BYTES_PER_EDGE;
+}
+
+void search_tree_t::collect_garbage(size_t max_bytes) {
+    if (this->memory_usage() <= max_bytes) {
+        return;
+    }
+    // the visits of a node never exceed those of its parent in a tree, so keeping
+    // every node above a visit threshold keeps a connected tree
+    std::vector<std::pair<int, size_t>> costs;
+    costs.reserve(this->nodes.size());
+    for (node_index_t index = 1; index < this->nodes.size(); ++index) {
+        auto& node = this->nodes[index];
+        costs.emplace_back(node.visit_count, sizeof(node_t) + node.num_edges * edges_t::BYTES_PER_EDGE);
+    }
+    std::sort(costs.begin(), costs.end(), std::greater<>());
+    size_t used = sizeof(node_t) + this->nodes[this->root()].num_edges * edges_t::BYTES_PER_EDGE;
+    int min_visits = std::numeric_limits<int>::max();
+    for (auto& [visits, cost] : costs) {
+        if (used + cost > max_bytes) {
+            // nodes with as many visits as the first one that does not fit go too
+            min_visits = visits + 1;
             break;
         }
-        node = node->select_best_child();
-        if (!node) {
-            Logger::log("Maybe segfault saver");
+        used += cost;
+    }
+    this->copy_subtree(this->root(), min_visits);
+}
+
+void search_tree_t::copy_subtree(node_index_t index, int min_visits) {
+    this->spare_nodes.clear();
+    this->spare_edges.clear();
+    this->spare_nodes.push_back(this->nodes[index]);
+    this->spare_nodes[0].parent = NULL_NODE;
+    this->spare_nodes[0].parent_edge = NULL_EDGE;
+
+    // a node shared by several parents is copied once
+    this->reroot_map.assign(this->nodes.size(), NULL_NODE);
+    this->reroot_map[index] = 0;
+
+    // pairs of (index in this tree, index in the new tree)
+    this->reroot_stack.clear();
+    this->reroot_stack.emplace_back(index, 0);
+    while (!this->reroot_stack.empty()) {
+        auto [old_index, new_index] = this->reroot_stack.back();
+        this->reroot_stack.pop_back();
+        auto& node = this->nodes[old_index];
+        if (!node.is_expanded()) {
+            continue;
+        }
+        auto first_edge = static_cast<edge_index_t>(this->spare_edges.size());
+        this->spare_edges.resize(first_edge + node.num_edges);
+        for (uint32_t i = 0; i < node.num_edges; ++i) {
+            auto old_edge = node.first_edge + i;
+            auto new_edge = first_edge + i;
+            this->spare_edges.moves[new_edge] = this->edges.moves[old_edge];
+            this->spare_edges.priors[new_edge] = this->edges.priors[old_edge];
+            this->spare_edges.visits[new_edge] = this->edges.visits[old_edge];
+            this->spare_edges.values[new_edge] = this->edges.values[old_edge];
+            auto child = this->edges.children[old_edge];
+            if (child != NULL_NODE && this->nodes[child].visit_count < min_visits) {
+                // collapsed, the edge statistics stay
+                this->spare_edges.children[new_edge] = NULL_NODE;
+            } else if (child != NULL_NODE && this->reroot_map[child] != NULL_NODE) {
+                this->spare_edges.children[new_edge] = this->reroot_map[child];
+            } else if (child != NULL_NODE) {
+                auto new_child = static_cast<node_index_t>(this->spare_nodes.size());
+                this->spare_nodes.push_back(this->nodes[child]);
+                this->spare_nodes[new_child].parent = new_index;
+                this->spare_nodes[new_child].parent_edge = new_edge;
+                this->spare_edges.children[new_edge] = new_child;
+                this->reroot_map[child] = new_child;
+                this->reroot_stack.emplace_back(child, new_child);
+            }
+        }
+        this->spare_nodes[new_index].first_edge = first_edge;
+    }
+    std::swap(this->nodes, this->spare_nodes);
+    std::swap(this->edges, this->spare_edges);
+    this->root_action = NULL_EDGE;
+    this->root_policy.clear();
+
+    for (auto it = this->transpositions.begin(); it != this->transpositions.end();) {
+        if (this->reroot_map[it->second] == NULL_NODE) {
+            it = this->transpositions.erase(it);
+        } else {
+            it->second = this->reroot_map[it->second];
+            ++it;
+        }
+    }
+}
+
+edge_index_t search_tree_t::add_edges(node_index_t index, const action_probs_t& action_probs) {
+    if (this->nodes[index].is_expanded()) {
+        throw std::runtime_error("Node already expanded");
+    }
+    auto first_edge = this->allocate_edges(action_probs.size());
+    for (size_t i = 0; i < action_probs.size(); ++i) {
+        // slots taken while concurrent may hold stale data
+        this->edges.moves[first_edge + i] = action_probs[i].first;
+        this->edges.priors[first_edge + i] = action_probs[i].second;
+        this->edges.visits[first_edge + i] = 0;
+        this->edges.values[first_edge + i] = 0.0;
+        this->edges.children[first_edge + i] = NULL_NODE;
+    }
+    auto& node = this->nodes[index];
+    node.first_edge = first_edge;
+    // try_claim reads the flag from other workers
+    std::atomic_ref<uint8_t>(node.claimed).store(1, std::memory_order_relaxed);
+    std::atomic_ref<uint32_t>(node.num_edges).store(action_probs.size(), std::memory_order_release);
+    return first_edge;
+}
+
+node_index_t search_tree_t::get_child(node_index_t index, edge_index_t edge, uint64_t key) {
+    std::atomic_ref<node_index_t> child(this->edges.children[edge]);
+    auto existing = child.load(std::memory_order_acquire);
+    if (existing != NULL_NODE && existing != PENDING_NODE) {
+        return existing;
+    }
+    if (this->graph) {
+        auto [it, inserted] = this->transpositions.try_emplace(key, NULL_NODE);
+        if (inserted) {
+            it->second = this->allocate_node(index, edge);
+        }
+        this->edges.children[edge] = it->second;
+        return it->second;
+    }
+    if (!this->concurrent) {
+        auto created = this->allocate_node(index, edge);
+        this->edges.children[edge] = created;
+        return created;
+    }
+    if (existing == NULL_NODE && child.compare_exchange_strong(existing, PENDING_NODE, std::memory_order_acq_rel)) {
+        auto created = this->allocate_node(index, edge);
+        child.store(created, std::memory_order_release);
+        return created;
+    }
+    // another worker is allocating the child, which only takes a counter increment and a write
+    while (existing == PENDING_NODE) {
+        std::this_thread::yield();
+        existing = child.load(std::memory_order_acquire);
+    }
+    return existing;
+}
+
+bool search_tree_t::try_claim(node_index_t index) {
+    return std::atomic_ref<uint8_t>(this->nodes[index].claimed).exchange(1, std::memory_order_acq_rel) == 0;
+}
+
+edge_index_t search_tree_t::select_best_child(node_index_t index) const {
+    auto& node = this->nodes[index];
+    if (!node.is_expanded()) {
+        return NULL_EDGE;
+    }
+    auto first = node.first_edge;
+    auto count = static_cast<int>(node.num_edges);
+    const int* visits = &this->edges.visits[first];
+    const float* values = &this->edges.values[first];
+    if (this->concurrent) {
+        // the kernel scores a snapshot taken with atomic loads, other workers keep updating the edges
+        thread_local std::vector<int> visits_snapshot;
+        thread_local std::vector<float> values_snapshot;
+        visits_snapshot.resize(count);
+        values_snapshot.resize(count);
+        for (int i = 0; i < count; ++i) {
+            visits_snapshot[i] = load_relaxed(visits[i]);
+            values_snapshot[i] = load_relaxed(values[i]);
+        }
+        visits = visits_snapshot.data();
+        values = values_snapshot.data();
+    }
+    auto best = puct::select_best(
+        &this->edges.priors[first], visits, values, count, this->exploration(node), this->unvisited_q(index)
+    );
+    return best < 0 ? NULL_EDGE : first + best;
+}
+
+node_index_t search_tree_t::select_best_leaf(chess::Board& board, search_path_t& path, edge_index_t root_edge) {
+    path.clear();
+    auto index = this->root();
+    if (this->graph && this->transpositions.empty()) {
+        this->transpositions.emplace(board.hash(), index);
+    }
+    // a proven node is never expanded further, so the descent stops there
+    while (this->nodes[index].is_expanded() && !this->nodes[index].is_proven() && !path.full()) {
+        // expanded nodes are never terminal in a tree, in a graph a shared node
+        // may still be drawn by the moves of this path. Mate, stalemate and
+        // insufficient material do not depend on the path and end the descent
+        // before the node is expanded, so only the draw rules are checked.
+        if (this->graph && path.size > 0 && (board.isRepetition() || board.isHalfMoveDraw())) {
+            path.terminal = true;
             break;
         }
-        // Logger::log(join_str(" ", "Node", std::string(node->move.from()), std::string(node->move.to()), "Value", node->value, "Visit Count", node->visit_count));
-        // Logger::log("Fen: " + node->board.getFen());
-        // Logger::log("Move: " + std::string(node->move.from()) + " " + std::string(node->move.to()));
-        node->board.makeMove(node->move);
+        auto edge = path.size == 0 && root_edge != NULL_EDGE ? root_edge : this->select_best_child(index);
+        path.push(index, edge);
+        board.makeMove(this->edges.moves[edge]);
+        index = this->get_child(index, edge, board.hash());
+    }
+    path.leaf = index;
+    return index;
+}
+
+void search_tree_t::undo_moves(const search_path_t& path, chess::Board& board) const {
+    for (int i = path.size - 1; i >= 0; --i) {
+        board.unmakeMove(this->edges.moves[path.steps[i].edge]);
     }
-    return node;
 }
 
-float node_t::ucb_score(const std::shared_ptr<node_t> child) const {
+float search_tree_t::exploration(const node_t& node) const {
+    float visits = static_cast<float>(node.get_visit_count());
+    float c_puct = this->params.c_puct;
+    if (this->params.c_puct_factor != 0) {
+        c_puct += this->params.c_puct_factor * std::log((visits + this->params.c_puct_base + 1) / this->params.c_puct_base);
+    }
+    return c_puct * std::sqrt(visits);
+}
+
+float search_tree_t::unvisited_q(node_index_t index) const {
+    if (this->params.fpu_absolute) {
+        return this->params.fpu_value;
+    }
+    // the node value is from the side choosing among the children, on the same [0, 1] scale as Q
+    auto& node = this->nodes[index];
+    int visits = node.get_visit_count();
+    float parent_q = visits > 0 ? (node.get_value() / visits + 1) / 2 : 0.5f;
+    return parent_q - (index == this->root() ? this->params.fpu_reduction_root : this->params.fpu_reduction);
+}
+
+float search_tree_t::ucb_score(node_index_t parent, edge_index_t edge) const {
+    auto& parent_node = this->nodes[parent];
+    auto visits = load_relaxed(this->edges.visits[edge]);
     float q_value;
-    if (child->visit_count == 0) {
-        q_value = 0.5;
+    if (visits == 0) {
+        q_value = this->unvisited_q(parent);
     } else {
-        q_value = 1 - ((child->value / child->visit_count) + 1) / 2;
+        q_value = 1 - ((load_relaxed(this->edges.values[edge]) / visits) + 1) / 2;
     }
-    // Logger::log(join_str(" ", "Child", std::string(child->move.from()), std::string(child->move.to()), "Value", child->value, "Visit Count", child->visit_count, "Q Value", q_value, "prior", child->prior, "Parent visit count", this->visit_count));
-    return q_value + C_PUCT * child->prior * std::sqrt(this->visit_count) / (1 + child->visit_count);
+    return q_value + this->exploration(parent_node) * this->edges.priors[edge] / (1 + visits);
 }
 
-float node_t::expand() {
-    if (this->children.size() > 0) {
-        throw std::runtime_error("Node already expanded");
+std::optional<float> search_tree_t::terminal_value(node_index_t index, const chess::Board& board) {
+    auto& node = this->nodes[index];
+    if (node.is_proven()) {
+        return proof_value(node.get_proof());
     }
-    if (this->board.isGameOver().second != chess::GameResult::NONE) {
-        // Logger::log("expand see game over");
-        return this->board.isGameOver().second == chess::GameResult::WIN ? 1.0 : 
-               this->board.isGameOver().second == chess::GameResult::DRAW ? 0.0 : -1.0;
+    if (node.is_expanded()) {
+        return std::nullopt;
     }
-    // TODO wrap the output of board_to_tensor with a torch layer
-    auto state_tensor = utils::board_to_tensor(this->board);
+    chess::Movelist moves;
+    utils::legal_moves(moves, board);
+    return this->terminal_value(index, board, moves);
+}
 
-    auto fen = split(this->board.getFen(), " ");
-    std::string fen_without_fullmove;
-    for(int i = 0; i < 5; i++) {
-        fen_without_fullmove += fen[i] + " ";
+std::optional<float> search_tree_t::terminal_value(node_index_t index, const chess::Board& board, const chess::Movelist& moves) {
+    auto& node = this->nodes[index];
+    if (node.is_proven()) {
+        return proof_value(node.get_proof());
     }
-    fen_without_fullmove = fen_without_fullmove.substr(0, fen_without_fullmove.size() - 1);
+    if (node.is_expanded()) {
+        return std::nullopt;
+    }
+    auto value = terminal_value(board, moves);
+    // the result of a shared node depends on the path in a graph, it is not cached there
+    if (value.has_value() && !this->graph) {
+        set_proof(node, value.value() > 0 ? proof_t::WIN : value.value() < 0 ? proof_t::LOSS : proof_t::DRAW);
+    }
+    return value;
+}
 
-    auto& memory_instance = memory::getInstance();
+std::optional<float> search_tree_t::terminal_value(const chess::Board& board) {
+    chess::Movelist moves;
+    utils::legal_moves(moves, board);
+    return terminal_value(board, moves);
+}
 
-    while (true) {
-        {
-            std::unique_lock<std::mutex> lock(memory_instance.action_probs_map_mutex);
-            if (memory_instance.action_probs_map.contains(fen_without_fullmove)) {
-                break;
-            }
-        }
-        // Logger::log("Waiting for model to compute action probabilities for " + fen_without_fullmove);
-        
-        {
-            std::unique_lock<std::mutex> lock(memory_instance.boards_to_compute_and_processing_mutex);
-            if (std::find(memory_instance.processing.begin(), memory_instance.processing.end(), fen_without_fullmove) == memory_instance.processing.end() &&
-                std::find(memory_instance.boards_to_compute.begin(), memory_instance.boards_to_compute.end(), fen_without_fullmove) == memory_instance.boards_to_compute.end()) {
-                    memory_instance.boards_to_compute.push_back(fen_without_fullmove);
-            } 
-        }
-        std::this_thread::sleep_for(std::chrono::milliseconds(5)); // maybe need more times
+std::optional<float> search_tree_t::terminal_value(const chess::Board& board, const chess::Movelist& moves) {
+    // the results of isGameOver, a mate takes precedence over the draw rules
+    if (moves.empty() && board.inCheck()) {
+        return -1.0;
+    }
+    if (board.isHalfMoveDraw() || board.isInsufficientMaterial() || board.isRepetition() || moves.empty()) {
+        return 0.0;
     }
-    auto action_probs = memory_instance.action_probs_map[fen_without_fullmove].first;
+    return std::nullopt;
+}
+
+float search_tree_t::expand(node_index_t index, const chess::Board& board, evaluator_t& evaluator) {
+    if (this->nodes[index].is_expanded()) {
+        throw std::runtime_error("Node already expanded");
+    }
+    std::vector<evaluation_t> batch(1);
+    utils::legal_moves(batch[0].moves, board);
+    auto terminal = this->terminal_value(index, board, batch[0].moves);
+    if (terminal.has_value()) {
+        return terminal.value();
+    }
+    if (!evaluator.probe(board, batch[0])) {
+        batch[0].key = board.hash();
+        batch[0].fen = evaluation_key(board);
+        evaluator.evaluate(batch);
+    }
+    return this->expand(index, batch[0]);
+}
+
+float search_tree_t::expand(node_index_t index, const evaluation_t& evaluation) {
+    auto action_probs = evaluation.action_probs;
     float sum = 0;
     for (auto& action_prob : action_probs) {
         sum += action_prob.second;
     }
-
     for (auto& action_prob : action_probs) {
-        auto move = action_prob.first;
-        auto prob = action_prob.second / sum;
-        this->children.push_back(std::make_shared<node_t>(this->board, this->model, shared_from_this(), move, prob));
+        action_prob.second /= sum;
     }
-    return memory_instance.action_probs_map[fen_without_fullmove].second;
-
-
-/*
-    auto output = this->model->forward(torch::unsqueeze(state_tensor, 0));
+    this->add_edges(index, action_probs);
+    return evaluation.value;
+}
 
-    auto policy_tensor = std::get<0>(output)[0];
-    auto value_tensor = std::get<1>(output)[0];
-    chess::Movelist legal_moves;
-    chess::movegen::legalmoves(legal_moves, this->board);
-    action_probs_t action_probs;
+void search_tree_t::add_virtual_loss(const search_path_t& path, int amount) {
+    // every edge of the path looks like it was visited and lost for the side choosing it
+    for (int i = 0; i < path.size; ++i) {
+        auto& step = path.steps[i];
+        add_to(this->nodes[step.node].visit_count, amount, this->concurrent);
+        add_to(this->edges.visits[step.edge], amount, this->concurrent);
+        add_to(this->edges.values[step.edge], static_cast<float>(amount), this->concurrent);
+    }
+}
 
-    for (auto move : legal_moves) {
-        auto idx = utils::move_to_idx(move);
-        //Logger::log(join_str(" ", "Move", std::string(move.from()), std::string(move.to()), "idx", idx));
-        // Logger::log(join_str(" ", "Move", std::string(move.from()), std::string(move.to()), "idx", idx));
-        this->children.push_back(std::make_shared<node_t>(this->board, this->model, shared_from_this(), move, policy_tensor[idx].item<float>()));
-        action_probs.push_back(std::make_pair(move, policy_tensor[idx].item<float>()));
+void search_tree_t::backpropagate(const search_path_t& path, float value) {
+    // value is from the point of view of the side to move at the leaf
+    auto& leaf = this->nodes[path.leaf];
+    // a draw by the path is not a result of the shared position, it only goes to the edge into it
+    if (!path.terminal) {
+        add_to(leaf.visit_count, 1, this->concurrent);
+        add_to(leaf.value, value, this->concurrent);
+    }
+    for (int i = path.size - 1; i >= 0; --i) {
+        auto& step = path.steps[i];
+        add_to(this->edges.visits[step.edge], 1, this->concurrent);
+        if (this->graph && !(path.terminal && i == path.size - 1)) {
+            // the child may have been visited through other parents, the edge takes its Q
+            auto& child = this->nodes[this->edges.children[step.edge]];
+            this->edges.values[step.edge] = child.value / child.visit_count * this->edges.visits[step.edge];
+        } else {
+            add_to(this->edges.values[step.edge], value, this->concurrent);
+        }
+        value = -value;
+        auto& node = this->nodes[step.node];
+        add_to(node.visit_count, 1, this->concurrent);
+        add_to(node.value, value, this->concurrent);
+    }
+    if (this->solver && !this->graph) {
+        this->update_proofs(path);
     }
-    memory::getInstance().action_probs_map[fen_without_fullmove] = std::make_pair(action_probs, value_tensor[0].item<float>());
-    return value_tensor[0].item<float>();*/
 }
 
-void node_t::backpropagate(float value) {
-    this->visit_count++;
-    this->value += value;
-    if (auto parent = this->parent.lock()) {
-        parent->backpropagate(-value);
+void search_tree_t::update_proofs(const search_path_t& path) {
+    // only a proven leaf can prove its ancestors, walk up until a node stays open
+    if (!this->nodes[path.leaf].is_proven()) {
+        return;
+    }
+    for (int i = path.size - 1; i >= 0; --i) {
+        auto& step = path.steps[i];
+        auto& node = this->nodes[step.node];
+        if (node.is_proven()) {
+            return;
+        }
+        bool all_proven = true;
+        bool draw = false;
+        bool win = false;
+        for (auto edge = node.first_edge; edge < node.first_edge + node.num_edges && !win; ++edge) {
+            // acquire pairs with the store that published the child node
+            auto child = std::atomic_ref<node_index_t>(this->edges.children[edge]).load(std::memory_order_acquire);
+            auto proof = child == NULL_NODE || child == PENDING_NODE ? proof_t::UNKNOWN : this->nodes[child].get_proof();
+            win = proof == proof_t::LOSS;
+            draw = draw || proof == proof_t::DRAW;
+            all_proven = all_proven && proof != proof_t::UNKNOWN;
+            if (proof != proof_t::UNKNOWN && !this->concurrent) {
+                // the edge takes the exact value, so selection takes or avoids it at once
+                this->edges.values[edge] = proof_value(proof) * this->edges.visits[edge];
+            }
+        }
+        if (!win && !all_proven) {
+            return;
+        }
+        // a move to a lost position wins, otherwise every move draws at best
+        set_proof(node, win ? proof_t::WIN : draw ? proof_t::DRAW : proof_t::LOSS);
     }
 }
 
-chess::Move node_t::get_action() const {
+void search_tree_t::set_root_policy(edge_index_t action, std::vector<float> policy) {
+    this->root_action = action;
+    this->root_policy = std::move(policy);
+}
+
+chess::Move search_tree_t::get_action() const {
+    auto& root = this->nodes[this->root()];
+    if (root.get_proof() == proof_t::WIN) {
+        // the visits may still favour another move, play the proven win
+        for (auto edge = root.first_edge; edge < root.first_edge + root.num_edges; ++edge) {
+            auto child = this->edges.children[edge];
+            if (child != NULL_NODE && this->nodes[child].get_proof() == proof_t::LOSS) {
+                return this->edges.moves[edge];
+            }
+        }
+    }
+    if (this->root_action != NULL_EDGE) {
+        return this->edges.moves[this->root_action];
+    }
     auto action_probs_raw = get_action_probs();
     std::vector<float> action_probs;
 
@@ -167,30 +551,24 @@ chess::Move node_t::get_action() const {
         action_probs.push_back(action_probs_raw[i].second);
     }
 
-    return this->children[utils::random_choose(action_probs)]->move;
+    return action_probs_raw[utils::random_choose(action_probs)].first;
 }
 
-node_t::action_probs_t node_t::get_action_probs() const {
-    node_t::action_probs_t action_probs;
-    for (auto child : this->children) {
-        action_probs.push_back(std::make_pair(child->move, static_cast<float>(child->visit_count) / this->visit_count));
+search_tree_t::action_probs_t search_tree_t::get_action_probs() const {
+    search_tree_t::action_probs_t action_probs;
+    auto& root = this->nodes[this->root()];
+    for (edge_index_t edge = root.first_edge; edge < root.first_edge + root.num_edges; ++edge) {
+        float prob = this->root_policy.empty() ?
+            static_cast<float>(this->edges.visits[edge]) / root.visit_count : this->root_policy[edge - root.first_edge];
+        action_probs.push_back(std::make_pair(this->edges.moves[edge], prob));
     }
     return action_probs;
 }
 
-torch::Tensor node_t::get_action_probs_tensor() const {
+torch::Tensor search_tree_t::get_action_probs_tensor() const {
     torch::Tensor action_probs_tensor = torch::zeros({73 * 64});
-    for (auto child : this->children) {
-        action_probs_tensor[utils::move_to_idx(child->move)] = static_cast<float>(child->visit_count) / this->visit_count;
-        // Logger::log(join_str(" ", "Move", std::string(child->move.from()), std::string(child->move.to()), "idx", utils::move_to_idx(child->move), "Child visit count", child->visit_count, "Parent visit count", this->visit_count));
+    for (auto& [move, prob] : this->get_action_probs()) {
+        action_probs_tensor[utils::move_to_idx(move)] = prob;
     }
     return action_probs_tensor;
 }
-
-float node_t::get_value() const {
-    return this->value;
-}
-
-std::vector<std::shared_ptr<node_t>> node_t::get_children() const {
-    return std::move(children);
-}
\ No newline at end of file
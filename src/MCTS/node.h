@@ -1,60 +1,270 @@
-
 #include "chess/chess.hpp"
 #include <torch/torch.h>
-#include <memory>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <unordered_map>
 #include <vector>
 #include "model.h"
 #include "board_utils.h"
+#include "evaluator.h"
 
 
 #ifndef MCTS_NODE_H
 #define MCTS_NODE_H
 
-#define C_PUCT 1.0
+typedef uint32_t node_index_t;
+typedef uint32_t edge_index_t;
+
+constexpr node_index_t NULL_NODE = std::numeric_limits<node_index_t>::max();
+constexpr edge_index_t NULL_EDGE = std::numeric_limits<edge_index_t>::max();
 
-class node_t : public std::enable_shared_from_this<node_t>
+// Selection parameters of the PUCT descent. The exploration factor grows with
+// the visits N of the parent as c_puct + c_puct_factor * log((N + c_puct_base + 1) / c_puct_base).
+// Unvisited children are scored with the first play urgency: fpu_value if
+// fpu_absolute, else the Q of the parent minus fpu_reduction, or minus
+// fpu_reduction_root at the root.
+//
+// Both depend only on the parent, so they are computed once per node and the
+// PUCT kernel scores the children without looking at the parameters.
+struct search_params_t
 {
+    static constexpr float DEFAULT_C_PUCT = 1.0;
 
-public:
-    node_t(chess::Board& board, std::shared_ptr<torch::nn::Module> model,  std::shared_ptr<node_t> parent=nullptr, chess::Move move = 0, float prior=0.0);
-    // node_t operator=(const node_t& node);
-
-    // copy constructor
-    /*
-    node_t(const node_t& node) {
-        this->parent = node.parent;
-        this->move = node.move;
-        this->value = node.value;
-        this->visit_count = node.visit_count;
-        this->is_leaf = node.is_leaf;
-        this->prior = node.prior;
-    }*/
+    float c_puct = DEFAULT_C_PUCT;
+    float c_puct_base = 19652.0;
+    float c_puct_factor = 0.0;
+    bool fpu_absolute = true;
+    float fpu_value = 0.5;
+    float fpu_reduction = 0.0;
+    float fpu_reduction_root = 0.0;
+};
+
+// A relaxed atomic load of a statistic that concurrent workers update through
+// atomic_ref, a plain load on x86 and ARM.
+template <typename T>
+T load_relaxed(const T& value) {
+    return std::atomic_ref<T>(const_cast<T&>(value)).load(std::memory_order_relaxed);
+}
+
+// Game theoretic value of a node for its side to move. Terminal positions
+// are proven the first time a descent reaches them, the solver proves the
+// other nodes from their children.
+enum class proof_t : uint8_t
+{
+    UNKNOWN,
+    WIN,
+    DRAW,
+    LOSS
+};
+
+// A visited position of the search tree. Nodes live in a search_tree_t arena
+// and refer to each other by index, the outgoing moves of a node are the edge
+// range [first_edge, first_edge + num_edges).
+struct node_t
+{
+    node_t(node_index_t parent = NULL_NODE, edge_index_t parent_edge = NULL_EDGE);
 
+    // num_edges is published last by add_edges, so a worker that sees it also sees the edges
+    bool is_expanded() const {
+        return std::atomic_ref<uint32_t>(const_cast<uint32_t&>(num_edges)).load(std::memory_order_acquire) > 0;
+    }
+    proof_t get_proof() const {
+        return std::atomic_ref<proof_t>(const_cast<proof_t&>(proof)).load(std::memory_order_relaxed);
+    }
+    // a node is a leaf of every descent once proven, an unexpanded proven node is terminal
+    bool is_proven() const { return get_proof() != proof_t::UNKNOWN; }
+    bool is_claimed() const {
+        return std::atomic_ref<uint8_t>(const_cast<uint8_t&>(claimed)).load(std::memory_order_relaxed) != 0;
+    }
+    int get_visit_count() const { return load_relaxed(visit_count); }
+    float get_value() const { return load_relaxed(value); }
+
+    node_index_t parent;
+    edge_index_t parent_edge;
+    edge_index_t first_edge;
+    uint32_t num_edges;
+    float value;
+    int visit_count;
+    // set by the worker that evaluates the node, see search_tree_t::try_claim
+    uint8_t claimed;
+    proof_t proof;
+};
+
+// The children of every node in struct-of-arrays form, so scoring the
+// children of a node streams through contiguous memory. The statistics of a
+// child are kept on its edge, the child node itself is only materialized in
+// children when the edge is visited for the first time (see get_child).
+struct edges_t
+{
+    static constexpr size_t BYTES_PER_EDGE = sizeof(chess::Move) + 2 * sizeof(float) + sizeof(int) + sizeof(node_index_t);
+
+    size_t size() const { return moves.size(); }
+    void clear();
+    void resize(size_t size);
+
+    std::vector<chess::Move> moves;
+    std::vector<float> priors;
+    std::vector<int> visits;
+    std::vector<float> values;
+    std::vector<node_index_t> children;
+};
+
+// The (node, edge) steps a descent took from the root, in a fixed capacity
+// stack owned by the worker, so recording a path never allocates. A descent
+// stops at MAX_DEPTH plies even if the node there is already expanded.
+struct search_path_t
+{
+    static constexpr int MAX_DEPTH = 256;
+
+    struct step_t
+    {
+        node_index_t node;
+        edge_index_t edge;
+    };
+
+    void clear() { size = 0; leaf = NULL_NODE; terminal = false; }
+    bool full() const { return size == MAX_DEPTH; }
+    void push(node_index_t node, edge_index_t edge) { steps[size++] = {node, edge}; }
+
+    std::array<step_t, MAX_DEPTH> steps;
+    int size = 0;
+    node_index_t leaf = NULL_NODE;
+    // set in graph mode when the path itself draws the game at an expanded
+    // shared leaf, by repetition or the 50 move rule
+    bool terminal = false;
+};
+
+// Node arena of a single search. Every node and edge of the tree is stored in
+// contiguous buffers, reset() releases the whole tree in O(1) and keeps the
+// buffers for the next search. reroot() keeps only the subtree of one node by
+// copying it into a spare pair of buffers, which are swapped in afterwards.
+//
+// In graph mode the tree is a DAG: get_child() looks positions up by their
+// Zobrist hash, so transpositions share one node and its statistics. Visits
+// stay on the edges, but after every backup the value of an edge is set from
+// the Q of its shared child, so an edge also sees the results gathered through
+// the other parents of the child. parent and parent_edge of a node are the
+// ones it was first reached by. Graph mode does not support concurrent workers.
+//
+// Terminal positions are detected once and cached in the proof of their node.
+// With the solver, proofs are also propagated up after every backup: a node
+// with a lost child is won, a node whose children are all proven is drawn or
+// lost. A descent stops at a proven node, so proven subtrees take no further
+// evaluations. Outside concurrent mode, the values of the edges into proven
+// children are made exact, so selection prefers or avoids them at once.
+//
+// collect_garbage() bounds the memory of long searches: it keeps the most
+// visited nodes and collapses the subtrees of the others back into their
+// edges, which keep their visits and values, by copying the kept nodes into the
+// spare buffers like reroot(). A collapsed edge gets a fresh child when a
+// descent takes it again. Both buffer pairs stay allocated, so the tree uses
+// up to twice its budget.
+//
+// The tree holds no board, a descent plays the selected moves on the caller's
+// board with makeMove and records them in a search_path_t, undo_moves() takes
+// them back with unmakeMove.
+//
+// Between begin_concurrent() and end_concurrent() several workers may descend,
+// expand and back up at once. The buffers are grown up front and new nodes and
+// edges are taken with an atomic counter, so they never move during that time.
+// Counters are updated and read with relaxed atomics, so selection may see them
+// slightly stale, which only changes which child is picked. The first worker
+// to take an edge reserves its child slot with a CAS and publishes the new
+// node with a release store, the others wait for it instead of allocating.
+class search_tree_t
+{
+public:
     typedef std::pair<chess::Move, float> action_prob_t;
     typedef std::vector<std::pair<chess::Move, float>> action_probs_t;
 
-    std::shared_ptr<node_t> select_best_child();
-    float expand();
-    void backup(float value);
-    float ucb_score(const std::shared_ptr<node_t> child) const;
-    std::shared_ptr<node_t> select_best_leaf();
-    void backpropagate(float value);
+    search_tree_t();
+
+    void reset();
+    void reroot(node_index_t index);
+    // collapses the least visited subtrees until memory_usage() is at most max_bytes
+    void collect_garbage(size_t max_bytes);
+    // bytes of the nodes and edges in use, without the spare buffers
+    size_t memory_usage() const;
+    node_index_t root() const { return 0; }
+    // safe to call while workers add nodes
+    size_t size() const {
+        return concurrent ? std::atomic_ref<uint32_t>(node_count).load(std::memory_order_relaxed) : nodes.size();
+    }
+    // may be called again while concurrent to make room for more nodes and edges
+    void begin_concurrent(size_t max_new_nodes, size_t max_new_edges);
+    void end_concurrent();
+    bool is_concurrent() const { return concurrent; }
+    void set_graph(bool graph) { this->graph = graph; }
+    void set_solver(bool solver) { this->solver = solver; }
+    void set_params(const search_params_t& params) { this->params = params; }
+    const search_params_t& get_params() const { return params; }
+    bool is_graph() const { return graph; }
+    node_t& operator[](node_index_t index) { return nodes[index]; }
+    const node_t& operator[](node_index_t index) const { return nodes[index]; }
+    edge_index_t add_edges(node_index_t index, const action_probs_t& action_probs);
+    // key is the hash of the child position, only used in graph mode
+    node_index_t get_child(node_index_t index, edge_index_t edge, uint64_t key = 0);
+    // true for exactly one caller per node, that caller has to expand it
+    bool try_claim(node_index_t index);
+
+    edge_index_t select_best_child(node_index_t index) const;
+    // root_edge forces the first move of the descent instead of selecting it
+    node_index_t select_best_leaf(chess::Board& board, search_path_t& path, edge_index_t root_edge = NULL_EDGE);
+    void undo_moves(const search_path_t& path, chess::Board& board) const;
+    float expand(node_index_t index, const chess::Board& board, evaluator_t& evaluator);
+    float expand(node_index_t index, const evaluation_t& evaluation);
+    void add_virtual_loss(const search_path_t& path, int amount);
+    float ucb_score(node_index_t parent, edge_index_t edge) const;
+    void backpropagate(const search_path_t& path, float value);
+    // the value of a terminal leaf, computed from the board on the first visit and cached
+    std::optional<float> terminal_value(node_index_t index, const chess::Board& board);
+    // same, with the legal moves of board already generated by the caller
+    std::optional<float> terminal_value(node_index_t index, const chess::Board& board, const chess::Movelist& moves);
+    // the move and the improved policy chosen by a Gumbel root, they replace the root visit distribution
+    void set_root_policy(edge_index_t action, std::vector<float> policy);
     chess::Move get_action() const;
-    float get_value() const;
     action_probs_t get_action_probs() const;
     torch::Tensor get_action_probs_tensor() const;
-    std::vector<std::shared_ptr<node_t>> get_children() const;
-    float get_prior() const { return prior; }
-    int get_visit_count() const { return visit_count; }
-
-    chess::Board& board;
-    std::shared_ptr<torch::nn::Module> model;
-    std::weak_ptr<node_t> parent;
-    chess::Move move;
-    std::vector<std::shared_ptr<node_t>> children;
-    float value;
-    int visit_count;
-    float prior;
+
+    static std::optional<float> terminal_value(const chess::Board& board);
+    // isGameOver() without a move generation of its own
+    static std::optional<float> terminal_value(const chess::Board& board, const chess::Movelist& moves);
+
+    edges_t edges;
+
+private:
+    node_index_t allocate_node(node_index_t parent, edge_index_t parent_edge);
+    edge_index_t allocate_edges(size_t count);
+    void update_proofs(const search_path_t& path);
+    // keeps the subtree of index, without the subtrees of nodes visited fewer than min_visits times
+    void copy_subtree(node_index_t index, int min_visits);
+    // c_puct * sqrt(N) and the first play urgency of the children of a node
+    float exploration(const node_t& node) const;
+    float unvisited_q(node_index_t index) const;
+
+    std::vector<node_t> nodes;
+    std::vector<node_t> spare_nodes;
+    edges_t spare_edges;
+    std::vector<std::pair<node_index_t, node_index_t>> reroot_stack;
+    // index in the new tree of every node copied by reroot
+    std::vector<node_index_t> reroot_map;
+    // set by set_root_policy for the current root, one probability per root edge
+    edge_index_t root_action = NULL_EDGE;
+    std::vector<float> root_policy;
+
+    bool concurrent = false;
+    bool graph = false;
+    bool solver = false;
+    search_params_t params;
+    // the node of every position of the graph, by Zobrist hash
+    std::unordered_map<uint64_t, node_index_t> transpositions;
+    // used slots of nodes and edges while concurrent, mutable so that const
+    // readers can load them through an atomic_ref
+    mutable uint32_t node_count = 0;
+    mutable uint32_t edge_count = 0;
 };
 
 #endif // MCTS_NODE_H
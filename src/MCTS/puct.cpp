@@ -0,0 +1,129 @@
+#include "puct.h"
+#include <limits>
+
+#ifdef PUCT_HAS_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+namespace puct {
+
+namespace {
+
+// Shared by the scalar kernel and the AVX2 tail so both paths produce bit identical scores.
+inline float score(float prior, int visits, float value, float exploration, float unvisited_q) {
+    float n = static_cast<float>(visits);
+    float q_value = visits == 0 ? unvisited_q : 1.0f - (value / n + 1.0f) / 2.0f;
+    return q_value + exploration * prior / (1.0f + n);
+}
+
+select_t resolve_select() {
+#ifdef PUCT_HAS_AVX2_KERNEL
+    if (has_avx2()) {
+        return select_avx2;
+    }
+#endif
+    return select_scalar;
+}
+
+} // namespace
+
+int select_scalar(const float* priors, const int* visits, const float* values, int count, float exploration, float unvisited_q) {
+    float best_score = -std::numeric_limits<float>::infinity();
+    int best = -1;
+    for (int i = 0; i < count; ++i) {
+        float child_score = score(priors[i], visits[i], values[i], exploration, unvisited_q);
+        if (child_score > best_score) {
+            best_score = child_score;
+            best = i;
+        }
+    }
+    return best;
+}
+
+#ifdef PUCT_HAS_AVX2_KERNEL
+
+// Scores 8 children per iteration. Every lane keeps its own running best, a
+// lane only replaces it on a strictly higher score so each lane holds the
+// first index of its maximum, the lanes are then reduced keeping the lowest
+// index on ties. This returns the same child as select_scalar.
+__attribute__((target("avx2")))
+int select_avx2(const float* priors, const int* visits, const float* values, int count, float exploration, float unvisited_q) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 unvisited_q_value = _mm256_set1_ps(unvisited_q);
+    const __m256 exploration_v = _mm256_set1_ps(exploration);
+    const __m256i step = _mm256_set1_epi32(8);
+
+    __m256 best_scores = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+    __m256i best_indices = _mm256_set1_epi32(-1);
+    __m256i indices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i visits_i = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(visits + i));
+        __m256 n = _mm256_cvtepi32_ps(visits_i);
+        __m256 w = _mm256_loadu_ps(values + i);
+        __m256 p = _mm256_loadu_ps(priors + i);
+
+        // unvisited lanes divide by zero here, the blend below discards them
+        __m256 q_value = _mm256_sub_ps(one, _mm256_div_ps(_mm256_add_ps(_mm256_div_ps(w, n), one), two));
+        __m256 unvisited = _mm256_castsi256_ps(_mm256_cmpeq_epi32(visits_i, _mm256_setzero_si256()));
+        q_value = _mm256_blendv_ps(q_value, unvisited_q_value, unvisited);
+
+        __m256 scores = _mm256_add_ps(q_value, _mm256_div_ps(_mm256_mul_ps(exploration_v, p), _mm256_add_ps(one, n)));
+
+        __m256 better = _mm256_cmp_ps(scores, best_scores, _CMP_GT_OQ);
+        best_scores = _mm256_blendv_ps(best_scores, scores, better);
+        best_indices = _mm256_castps_si256(_mm256_blendv_ps(
+            _mm256_castsi256_ps(best_indices), _mm256_castsi256_ps(indices), better));
+        indices = _mm256_add_epi32(indices, step);
+    }
+
+    alignas(32) float lane_scores[8];
+    alignas(32) int lane_indices[8];
+    _mm256_store_ps(lane_scores, best_scores);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lane_indices), best_indices);
+
+    float best_score = -std::numeric_limits<float>::infinity();
+    int best = -1;
+    for (int lane = 0; lane < 8; ++lane) {
+        if (lane_indices[lane] < 0) {
+            continue;
+        }
+        if (lane_scores[lane] > best_score || (lane_scores[lane] == best_score && lane_indices[lane] < best)) {
+            best_score = lane_scores[lane];
+            best = lane_indices[lane];
+        }
+    }
+
+    for (; i < count; ++i) {
+        float child_score = score(priors[i], visits[i], values[i], exploration, unvisited_q);
+        if (child_score > best_score) {
+            best_score = child_score;
+            best = i;
+        }
+    }
+    return best;
+}
+
+bool has_avx2() {
+    // the CPU model may not be detected yet when this runs during static initialization
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+bool has_avx2() {
+    return false;
+}
+
+#endif
+
+int select_best(const float* priors, const int* visits, const float* values, int count, float exploration, float unvisited_q) {
+    // resolved on the first call, after static initialization
+    static const select_t kernel = resolve_select();
+    return kernel(priors, visits, values, count, exploration, unvisited_q);
+}
+
+} // namespace puct
@@ -0,0 +1,33 @@
+#include <cstdint>
+
+
+#ifndef MCTS_PUCT_H
+#define MCTS_PUCT_H
+
+namespace puct {
+
+// Arg-max PUCT kernels over the struct-of-arrays edges of one node.
+//
+// score = Q + exploration * prior / (1 + visits), where Q = 1 - (value / visits + 1) / 2
+// and unvisited children get Q = unvisited_q, the first play urgency. exploration
+// is c_puct * sqrt(parent visits); both are computed once per node by the caller,
+// so the search parameters cost nothing per child. Returns the offset of the
+// first child with the highest score, or -1 when count is 0.
+typedef int (*select_t)(const float* priors, const int* visits, const float* values, int count, float exploration, float unvisited_q);
+
+int select_scalar(const float* priors, const int* visits, const float* values, int count, float exploration, float unvisited_q);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PUCT_HAS_AVX2_KERNEL
+int select_avx2(const float* priors, const int* visits, const float* values, int count, float exploration, float unvisited_q);
+#endif
+
+// true if the CPU we run on supports the AVX2 kernel
+bool has_avx2();
+
+// The fastest kernel supported by the CPU, resolved on the first call.
+int select_best(const float* priors, const int* visits, const float* values, int count, float exploration, float unvisited_q);
+
+} // namespace puct
+
+#endif // MCTS_PUCT_H
@@ -11,29 +11,64 @@
 #include "KotHModel.h"
 #include <mcts.h>
 #include "string_utils.h"
+#include <chrono>
+#include <mutex>
+#include <set>
 
 using namespace config;
 
+// Uniform priors over the legal moves and a draw value, without the model thread.
+class uniform_evaluator_t : public evaluator_t
+{
+public:
+    void evaluate(std::vector<evaluation_t>& batch) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batch_sizes.push_back(batch.size());
+            for (auto& evaluation : batch) {
+                keys.push_back(evaluation.key);
+            }
+        }
+        for (auto& evaluation : batch) {
+            evaluation.action_probs.clear();
+            for (const auto& move : evaluation.moves) {
+                evaluation.action_probs.emplace_back(move, chess::uci::moveToUci(move) == favourite ? 100.0 : 1.0);
+            }
+            evaluation.value = 0.0;
+        }
+    }
+
+    std::vector<size_t> batch_sizes;
+    std::vector<uint64_t> keys;
+    // a move in uci notation that gets a hundred times the prior of the others
+    std::string favourite;
+    std::mutex mutex;
+};
+
 TEST(TestSimulate, TestSimulateStart) {
     Config::MCTSConfig mcts_config;
     mcts_config.num_simulations = 1;
     mcts_config.exploration_constant = 1.0;
     auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config);
     chess::Board board;
-    chess::Board board_copy = chess::Board(board); 
-    auto root = std::make_shared<node_t>(board_copy, std::make_shared<KotHModel>());
-    mcts.simulate(root);
+    search_tree_t tree;
+    search_worker_t worker{board};
+    auto root = tree.root();
+    mcts.simulate(tree, worker);
 
-    ASSERT_EQ(root->value, 0);
-    ASSERT_EQ(root->visit_count, 1);
-    
-    mcts.simulate(root);
+    ASSERT_EQ(tree[root].value, 0);
+    ASSERT_EQ(tree[root].visit_count, 1);
+
+    ASSERT_EQ(worker.board.getFen(), board.getFen());
+    mcts.simulate(tree, worker);
 
-    ASSERT_EQ(root->value, 0);
-    ASSERT_EQ(root->visit_count, 2);
-    ASSERT_EQ(root->children[17]->visit_count, 1);
-    ASSERT_EQ(root->children[17]->value, 0);
-    ASSERT_EQ(root->children[17]->children.size(), 20);
+    auto edge = tree[root].first_edge + 17;
+    auto child = tree.edges.children[edge];
+    ASSERT_EQ(tree[root].value, 0);
+    ASSERT_EQ(tree[root].visit_count, 2);
+    ASSERT_EQ(tree.edges.visits[edge], 1);
+    ASSERT_EQ(tree.edges.values[edge], 0);
+    ASSERT_EQ(tree[child].num_edges, 20);
 
 }
 
@@ -44,31 +79,422 @@ TEST(TestSimulate, TestSimulateGameOver) {
     mcts_config.exploration_constant = 1.0;
     auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config);
     chess::Board board("r1bqkbnr/ppp2Qpp/2np4/4p3/2B1P3/8/PPPP1PPP/RNB1K1NR b KQkq - 0 1");
-    chess::Board board_copy = chess::Board(board); 
-    auto root = std::make_shared<node_t>(board_copy, std::make_shared<KotHModel>());
-    mcts.simulate(root);
+    search_tree_t tree;
+    search_worker_t worker{board};
+    mcts.simulate(tree, worker);
 
     // ASSERT_EQ(history->result, chess::GameResult::WIN);
-    ASSERT_EQ(root->value, 0);
-    ASSERT_EQ(root->visit_count, 0);
+    ASSERT_EQ(tree[tree.root()].value, 0);
+    ASSERT_EQ(tree[tree.root()].visit_count, 0);
 
     board = chess::Board("r1bqkbnr/ppp2Qpp/2np4/4p3/2B1P3/8/PPPP1PPP/RNB1K1NR b KQkq - 0 1");
-    board_copy = chess::Board(board); 
-    root = std::make_shared<node_t>(board_copy, std::make_shared<KotHModel>());
-    mcts.simulate(root);
+    tree.reset();
+    worker.board = board;
+    mcts.simulate(tree, worker);
 
-    ASSERT_EQ(root->value, 0);
-    ASSERT_EQ(root->visit_count, 0);
+    ASSERT_EQ(tree[tree.root()].value, 0);
+    ASSERT_EQ(tree[tree.root()].visit_count, 0);
 }
 
 TEST(TestSearch, TestSearch) {
     Config::MCTSConfig mcts_config;
     mcts_config.num_simulations = 1;
     mcts_config.exploration_constant = 1.0;
-    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config);
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
     chess::Board board;
-    auto root = mcts.search(board);
-    
+    auto& tree = mcts.search(board);
+
     Logger::log("Search result");
-    Logger::log(to_string(*root));
-}
\ No newline at end of file
+    Logger::log(to_string(tree));
+}
+
+TEST(TestSimulate, TestSimulateBatch) {
+    Config::MCTSConfig mcts_config;
+    auto evaluator = std::make_shared<uniform_evaluator_t>();
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, evaluator);
+    chess::Board board;
+    search_tree_t tree;
+    search_worker_t worker{board};
+    auto root = tree.root();
+    ASSERT_EQ(mcts.simulate(tree, worker, 1), 1);
+    ASSERT_EQ(mcts.simulate(tree, worker, 4), 4);
+
+    // virtual loss spreads the batch over four different children and is removed afterwards
+    ASSERT_EQ(evaluator->batch_sizes, std::vector<size_t>({1, 4}));
+    ASSERT_EQ(tree[root].visit_count, 5);
+    int visited_children = 0;
+    for (auto edge = tree[root].first_edge; edge < tree[root].first_edge + tree[root].num_edges; ++edge) {
+        ASSERT_LE(tree.edges.visits[edge], 1);
+        ASSERT_EQ(tree.edges.values[edge], 0);
+        visited_children += tree.edges.visits[edge];
+    }
+    ASSERT_EQ(visited_children, 4);
+    ASSERT_EQ(worker.board.getFen(), board.getFen());
+}
+
+TEST(TestSearch, TestSearchParallel) {
+    Config::MCTSConfig mcts_config;
+    mcts_config.num_simulations = 3000;
+    mcts_config.search_batch_size = 4;
+    mcts_config.search_threads = 4;
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
+    chess::Board board;
+    auto& tree = mcts.search(board, 1);
+
+    // every simulation is backed up exactly once and no virtual loss is left behind
+    auto& root = tree[tree.root()];
+    ASSERT_EQ(root.visit_count, 3000);
+    int child_visits = 0;
+    for (auto edge = root.first_edge; edge < root.first_edge + root.num_edges; ++edge) {
+        child_visits += tree.edges.visits[edge];
+        auto child = tree.edges.children[edge];
+        if (child != NULL_NODE) {
+            ASSERT_EQ(tree[child].visit_count, tree.edges.visits[edge]);
+            ASSERT_EQ(tree[child].value, tree.edges.values[edge]);
+        }
+    }
+    ASSERT_EQ(child_visits, 2999);
+    ASSERT_FALSE(tree.is_concurrent());
+}
+
+TEST(TestSearch, TestGraphSearchSharesTranspositions) {
+    // positions that were sent to the evaluator more than once
+    auto repeated_evaluations = [](bool graph_search) {
+        Config::MCTSConfig mcts_config;
+        mcts_config.num_simulations = 2000;
+        mcts_config.graph_search = graph_search;
+        auto evaluator = std::make_shared<uniform_evaluator_t>();
+        auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, evaluator);
+        chess::Board board("r1bqkb1r/pppp1ppp/2n2n2/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4");
+        auto& tree = mcts.search(board, 1);
+        EXPECT_EQ(tree[tree.root()].visit_count, 2000);
+        std::set<uint64_t> keys(evaluator->keys.begin(), evaluator->keys.end());
+        return evaluator->keys.size() - keys.size();
+    };
+    ASSERT_EQ(repeated_evaluations(true), 0);
+    ASSERT_GT(repeated_evaluations(false), 0);
+}
+
+TEST(TestSearch, TestEarlyStopSingleMove) {
+    Config::MCTSConfig mcts_config;
+    mcts_config.num_simulations = 200;
+    mcts_config.early_stop = true;
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
+    // Kxb2 is the only legal move
+    chess::Board board("k7/8/8/8/8/8/1r6/K7 w - - 0 1");
+    auto& tree = mcts.search(board, 1);
+
+    ASSERT_EQ(tree[tree.root()].visit_count, 1);
+    ASSERT_EQ(mcts.last_search_stats().simulations, 1);
+    ASSERT_EQ(mcts.last_search_stats().saved_simulations, 199);
+}
+
+TEST(TestSearch, TestEarlyStopUnassailableLeader) {
+    Config::MCTSConfig mcts_config;
+    mcts_config.num_simulations = 400;
+    mcts_config.early_stop = true;
+    auto evaluator = std::make_shared<uniform_evaluator_t>();
+    evaluator->favourite = "b1b2";
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, evaluator);
+    chess::Board board("k7/8/8/8/8/8/1q6/KR6 w - - 0 1");
+    auto& tree = mcts.search(board, 1);
+    auto stats = mcts.last_search_stats();
+
+    auto& root = tree[tree.root()];
+    ASSERT_GT(stats.saved_simulations, 0);
+    ASSERT_EQ(stats.simulations + stats.saved_simulations, 400);
+    ASSERT_EQ(stats.simulations, root.visit_count);
+    int leader = 0;
+    int runner_up = 0;
+    for (auto edge = root.first_edge; edge < root.first_edge + root.num_edges; ++edge) {
+        int visits = tree.edges.visits[edge];
+        runner_up = std::max(runner_up, std::min(leader, visits));
+        leader = std::max(leader, visits);
+    }
+    ASSERT_GT(leader - runner_up, static_cast<int>(stats.saved_simulations));
+}
+
+TEST(TestSearch, TestEarlyStopKL) {
+    Config::MCTSConfig mcts_config;
+    mcts_config.num_simulations = 1000;
+    mcts_config.early_stop = true;
+    mcts_config.early_stop_kl_threshold = 10.0;
+    mcts_config.kl_check_interval = 50;
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
+    chess::Board board;
+    auto& tree = mcts.search(board, 1);
+
+    // the first checkpoint is taken after 50 simulations, the second one is close enough to stop
+    ASSERT_EQ(tree[tree.root()].visit_count, 100);
+    ASSERT_EQ(mcts.last_search_stats().saved_simulations, 900);
+}
+
+TEST(TestSearch, TestNoEarlyStopByDefault) {
+    Config::MCTSConfig mcts_config;
+    mcts_config.num_simulations = 50;
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
+    chess::Board board("k7/8/8/8/8/8/1r6/K7 w - - 0 1");
+    auto& tree = mcts.search(board, 1);
+
+    ASSERT_EQ(tree[tree.root()].visit_count, 50);
+    ASSERT_EQ(mcts.last_search_stats().saved_simulations, 0);
+}
+
+TEST(TestSearch, TestSimulationSchedule) {
+    Config::MCTSConfig mcts_config;
+    mcts_config.num_simulations = 100;
+    ASSERT_EQ(mcts_config.simulations(0), 100);
+    ASSERT_EQ(mcts_config.simulations(100), 100);
+
+    mcts_config.simulation_schedule = "ramp";
+    mcts_config.simulations_per_iteration = 50;
+    mcts_config.max_simulations = 400;
+    ASSERT_EQ(mcts_config.simulations(1), 100);
+    ASSERT_EQ(mcts_config.simulations(3), 200);
+    ASSERT_EQ(mcts_config.simulations(100), 400);
+
+    mcts_config.simulation_schedule = "table";
+    mcts_config.simulation_table = {50, 75, 120};
+    ASSERT_EQ(mcts_config.simulations(1), 50);
+    ASSERT_EQ(mcts_config.simulations(2), 75);
+    ASSERT_EQ(mcts_config.simulations(100), 120);
+
+    ASSERT_THROW(mcts_config.load_config({{"simulation_schedule", "linear"}}), std::runtime_error);
+}
+
+TEST(TestSearch, TestNodeLimit) {
+    Config::MCTSConfig mcts_config;
+    mcts_config.num_simulations = 1000;
+    mcts_config.max_nodes = 50;
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
+    chess::Board board;
+    auto& tree = mcts.search(board, 1);
+
+    ASSERT_EQ(tree.size(), 50);
+    ASSERT_LT(tree[tree.root()].visit_count, 1000);
+    ASSERT_EQ(mcts.last_search_stats().saved_simulations, 0);
+}
+
+TEST(TestSearch, TestFastSearch) {
+    Config::MCTSConfig mcts_config;
+    mcts_config.num_simulations = 200;
+    mcts_config.fast_simulations = 20;
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
+    chess::Board board;
+
+    auto& tree = mcts.search(board, 1, false);
+    ASSERT_EQ(tree[tree.root()].visit_count, 20);
+    mcts.search(board, 1, true);
+    ASSERT_EQ(tree[tree.root()].visit_count, 200);
+}
+
+TEST(TestSearch, TestFastSearchOnReusedTree) {
+    Config::MCTSConfig mcts_config;
+    mcts_config.num_simulations = 400;
+    mcts_config.fast_simulations = 20;
+    mcts_config.reuse_tree = true;
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
+    chess::Board board;
+
+    auto& tree = mcts.search(board, 1, true);
+    auto move = tree.get_action();
+    mcts.advance(move);
+    board.makeMove(move);
+    // the kept subtree already has the visits of a fast search, it still runs its own simulations
+    unsigned int kept = tree[tree.root()].visit_count;
+    ASSERT_GE(kept, 20);
+    mcts.search(board, 1, false);
+    ASSERT_EQ(mcts.last_search_stats().simulations, 20);
+    ASSERT_EQ(tree[tree.root()].visit_count, kept + 20);
+}
+
+TEST(TestSearch, TestSolverStopsOnProvenWin) {
+    Config::MCTSConfig mcts_config;
+    mcts_config.num_simulations = 400;
+    mcts_config.solver = true;
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
+    // Rh8 is the only mate
+    chess::Board board("k7/8/1K6/8/8/8/8/7R w - - 0 1");
+    auto& tree = mcts.search(board, 1);
+    auto stats = mcts.last_search_stats();
+
+    ASSERT_EQ(tree[tree.root()].get_proof(), proof_t::WIN);
+    ASSERT_GT(stats.saved_simulations, 0);
+    ASSERT_EQ(stats.simulations + stats.saved_simulations, 400);
+    ASSERT_EQ(chess::uci::moveToUci(tree.get_action()), "h1h8");
+}
+
+TEST(TestSearch, TestOneMoveGenerationPerLeaf) {
+#ifndef MOVEGEN_STATS
+    GTEST_SKIP() << "needs a build configured with MOVEGEN_STATS";
+#else
+    Config::MCTSConfig mcts_config;
+    mcts_config.num_simulations = 200;
+    mcts_config.search_batch_size = 8;
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
+    chess::Board board;
+    auto movegen_start = utils::movegen_count();
+    auto& tree = mcts.search(board, 1);
+
+    // the unexpanded root is also checked for game over by search and simulate
+    ASSERT_LE(utils::movegen_count() - movegen_start, tree[tree.root()].visit_count + 2);
+#endif
+}
+
+TEST(TestSearch, TestGumbelRoot) {
+    Config::MCTSConfig mcts_config;
+    mcts_config.num_simulations = 32;
+    mcts_config.root_selection = "gumbel";
+    mcts_config.gumbel_top_k = 4;
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
+    chess::Board board;
+    auto& tree = mcts.search(board, 1);
+
+    auto& root = tree[tree.root()];
+    ASSERT_EQ(root.visit_count, 32);
+    int visited = 0;
+    int most_visits = 0;
+    for (auto edge = root.first_edge; edge < root.first_edge + root.num_edges; ++edge) {
+        visited += tree.edges.visits[edge] > 0;
+        most_visits = std::max(most_visits, tree.edges.visits[edge]);
+    }
+    // only the sampled moves are searched, the survivor of sequential halving was visited in every phase
+    ASSERT_EQ(visited, 4);
+    auto action = tree.get_action();
+    for (auto edge = root.first_edge; edge < root.first_edge + root.num_edges; ++edge) {
+        if (tree.edges.moves[edge] == action) {
+            ASSERT_EQ(tree.edges.visits[edge], most_visits);
+        }
+    }
+    float sum = 0;
+    for (auto& [move, prob] : tree.get_action_probs()) {
+        ASSERT_GT(prob, 0);
+        sum += prob;
+    }
+    ASSERT_NEAR(sum, 1.0, 1e-5);
+}
+
+TEST(TestSearch, TestTimedSearch) {
+    Config::MCTSConfig mcts_config;
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
+    chess::Board board;
+    time_control_t time_control;
+    time_control.move_time_ms = 40;
+    auto start = std::chrono::steady_clock::now();
+    auto& tree = mcts.search(board, time_control);
+    auto elapsed = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    ASSERT_GT(tree[tree.root()].visit_count, 1);
+    ASSERT_GE(elapsed, 40 / mcts_config.time_max_factor * mcts_config.time_min_factor);
+    // the deadline is checked once per simulation batch, the margin is for loaded machines
+    ASSERT_LT(elapsed, 40 * 5);
+    ASSERT_EQ(mcts.last_search_stats().saved_simulations, 0);
+}
+
+TEST(TestSearch, TestTimedSearchOutOfTime) {
+    Config::MCTSConfig mcts_config;
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
+    chess::Board board;
+    time_control_t time_control;
+    time_control.remaining_ms = mcts_config.move_overhead_ms;
+    auto& tree = mcts.search(board, time_control);
+
+    // no time left, but the root is expanded so there is a move to play
+    ASSERT_TRUE(tree[tree.root()].is_expanded());
+    ASSERT_EQ(tree[tree.root()].visit_count, 1);
+}
+
+TEST(TestSearch, TestTimedSearchSingleMove) {
+    Config::MCTSConfig mcts_config;
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
+    // Kxb2 is the only legal move
+    chess::Board board("k7/8/8/8/8/8/1r6/K7 w - - 0 1");
+    time_control_t time_control;
+    time_control.remaining_ms = 60000;
+    time_control.increment_ms = 1000;
+    auto& tree = mcts.search(board, time_control);
+
+    // the target is about 3 s, a forced move is played once the root is expanded,
+    // so the search stops after its first simulation rather than by the clock
+    ASSERT_EQ(tree[tree.root()].visit_count, 1);
+    ASSERT_EQ(chess::uci::moveToUci(tree.get_action()), "a1b2");
+}
+
+TEST(TestSearch, TestTreeMemoryCap) {
+    Config::MCTSConfig mcts_config;
+    mcts_config.num_simulations = 2000;
+    mcts_config.search_batch_size = 8;
+    mcts_config.max_tree_bytes = 64 << 10;
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
+    chess::Board board;
+    auto& tree = mcts.search(board, 1);
+
+    ASSERT_EQ(tree[tree.root()].visit_count, 2000);
+    ASSERT_GT(mcts.last_search_stats().garbage_collections, 0);
+    // checked before every batch, a batch adds at most 8 expanded nodes
+    ASSERT_LE(tree.memory_usage(), mcts_config.max_tree_bytes + 8 * (sizeof(node_t) + 218 * edges_t::BYTES_PER_EDGE));
+}
+
+TEST(TestSearch, TestStepSearchMatchesSearch) {
+    Config::MCTSConfig mcts_config;
+    mcts_config.num_simulations = 100;
+    mcts_config.search_batch_size = 8;
+    auto evaluator = std::make_shared<uniform_evaluator_t>();
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, evaluator);
+    auto stepped = MCTS(std::make_shared<KotHModel>(), mcts_config, evaluator);
+    chess::Board board;
+    auto& tree = mcts.search(board, 1);
+
+    // the caller evaluates the batches, as the lock-step self play does
+    stepped.begin_search(board, 1);
+    while (!stepped.search_done()) {
+        auto& batch = stepped.gather_batch();
+        ASSERT_LE(batch.size(), 8);
+        evaluator->evaluate(batch);
+        stepped.apply_batch();
+    }
+    auto& stepped_tree = stepped.end_search();
+
+    ASSERT_EQ(stepped_tree[stepped_tree.root()].visit_count, 100);
+    ASSERT_EQ(stepped.last_search_stats().simulations, 100);
+    auto first_edge = tree[tree.root()].first_edge;
+    auto stepped_first_edge = stepped_tree[stepped_tree.root()].first_edge;
+    for (uint32_t i = 0; i < tree[tree.root()].num_edges; ++i) {
+        ASSERT_EQ(stepped_tree.edges.visits[stepped_first_edge + i], tree.edges.visits[first_edge + i]);
+    }
+}
+
+TEST(TestSearch, TestGraphRepetitionBacksUpDraw) {
+    Config::MCTSConfig mcts_config;
+    auto mcts = MCTS(std::make_shared<KotHModel>(), mcts_config, std::make_shared<uniform_evaluator_t>());
+    search_tree_t tree;
+    tree.set_graph(true);
+    search_worker_t worker;
+    // the start position was already seen once, the cycle below repeats it a third time
+    std::vector<std::string> cycle = {"g1f3", "g8f6", "f3g1", "f6g8"};
+    for (auto& uci : cycle) {
+        worker.board.makeMove(chess::uci::uciToMove(worker.board, uci));
+    }
+    // a single expanded line around the cycle, back to the root through a transposition
+    auto board = worker.board;
+    tree.select_best_leaf(board, worker.path);
+    node_index_t node = tree.root();
+    edge_index_t edge = NULL_EDGE;
+    for (auto& uci : cycle) {
+        auto move = chess::uci::uciToMove(board, uci);
+        edge = tree.add_edges(node, {{move, 1.0f}});
+        board.makeMove(move);
+        node = tree.get_child(node, edge, board.hash());
+    }
+    ASSERT_EQ(node, tree.root());
+    // the shared node has a clearly winning estimate from its other visits
+    tree[tree.root()].visit_count = 4;
+    tree[tree.root()].value = 3.0;
+
+    ASSERT_EQ(mcts.simulate(tree, worker, 1), 1);
+
+    ASSERT_EQ(tree.edges.visits[edge], 1);
+    ASSERT_FLOAT_EQ(tree.edges.values[edge], 0.0);
+    // the draw belongs to the path, the shared node only counts the visit through its own edge
+    ASSERT_EQ(tree[tree.root()].visit_count, 5);
+}
@@ -8,193 +8,578 @@
 #include "board_utils.h"
 #include "node.h"
 
+static memory_evaluator_t evaluator;
+
 TEST(TestExtract, TestExtractStart) {
     chess::Board board;
-    auto tensor = utils::board_to_tensor(board);
-    std::shared_ptr<torch::nn::Module> model_ptr = std::make_shared<KotHModel>();
-
-    auto node = std::make_shared<node_t>(board, model_ptr);
+    search_tree_t tree;
+    auto root = tree.root();
 
     Logger::log("Extracting node");
 
-    ASSERT_EQ(node->expand(), 0);
-    ASSERT_EQ(node->children.size(), 20);
-    ASSERT_EQ(node->children[0]->prior, 1);
-    ASSERT_EQ(node->children[0]->move, chess::Move::make(chess::Square("a2"), chess::Square("a3")));
-    ASSERT_EQ(node->children[1]->prior, 1);
-    ASSERT_EQ(node->children[1]->move, chess::Move::make(chess::Square("b2"), chess::Square("b3")));
-    ASSERT_EQ(node->children[8]->prior, 2);
-    ASSERT_EQ(node->children[8]->move, chess::Move::make(chess::Square("a2"), chess::Square("a4")));
+    ASSERT_EQ(tree.expand(root, board, evaluator), 0);
+    auto edge = tree[root].first_edge;
+    ASSERT_EQ(tree[root].num_edges, 20);
+    ASSERT_EQ(tree.edges.priors[edge], 1);
+    ASSERT_EQ(tree.edges.moves[edge], chess::Move::make(chess::Square("a2"), chess::Square("a3")));
+    ASSERT_EQ(tree.edges.priors[edge + 1], 1);
+    ASSERT_EQ(tree.edges.moves[edge + 1], chess::Move::make(chess::Square("b2"), chess::Square("b3")));
+    ASSERT_EQ(tree.edges.priors[edge + 8], 2);
+    ASSERT_EQ(tree.edges.moves[edge + 8], chess::Move::make(chess::Square("a2"), chess::Square("a4")));
+    ASSERT_EQ(tree.edges.children[edge], NULL_NODE);
 }
 
 TEST(TestExtract, TestExtractGameOver) {
     chess::Board board("r1bqkbnr/ppp2Qpp/2np4/4p3/2B1P3/8/PPPP1PPP/RNB1K1NR b KQkq - 0 1");
-    auto tensor = utils::board_to_tensor(board);
-    std::shared_ptr<torch::nn::Module> model_ptr = std::make_shared<KotHModel>();
+    search_tree_t tree;
+    tree.expand(tree.root(), board, evaluator);
 
-    auto node = std::make_shared<node_t>(board, model_ptr);
-    node->expand();
-
-    ASSERT_EQ(node->children.size(), 0);
+    ASSERT_EQ(tree[tree.root()].num_edges, 0);
 }
 
 TEST(TestExtract, TestExtracAlreadyExpanded) {
     chess::Board board;
-    auto tensor = utils::board_to_tensor(board);
-    std::shared_ptr<torch::nn::Module> model_ptr = std::make_shared<KotHModel>();
-
-    auto node = std::make_shared<node_t>(board, model_ptr);
-    node->expand();
+    search_tree_t tree;
+    tree.expand(tree.root(), board, evaluator);
 
-    ASSERT_THROW(node->expand(), std::runtime_error);
+    ASSERT_THROW(tree.expand(tree.root(), board, evaluator), std::runtime_error);
 }
 
 TEST(TestBackPropagate, TestBackPropagateSingleNode) {
     chess::Board board;
-    auto tensor = utils::board_to_tensor(board);
-    std::shared_ptr<torch::nn::Module> model_ptr = std::make_shared<KotHModel>();
-
-    auto node = std::make_shared<node_t>(board, model_ptr);
-    node->expand();
-    node->backpropagate(1);
-
-    ASSERT_EQ(node->visit_count, 1);
-    ASSERT_EQ(node->value, 1);
+    search_tree_t tree;
+    auto root = tree.root();
+    tree.expand(root, board, evaluator);
+    search_path_t path;
+    path.clear();
+    path.leaf = root;
+    tree.backpropagate(path, 1);
+
+    ASSERT_EQ(tree[root].visit_count, 1);
+    ASSERT_EQ(tree[root].value, 1);
 }
 
 TEST(TestBackPropagate, TestBackPropagateMultipleNodes) {
     chess::Board board;
-    auto tensor = utils::board_to_tensor(board);
-    std::shared_ptr<torch::nn::Module> model_ptr = std::make_shared<KotHModel>();
-
-    auto node = std::make_shared<node_t>(board, model_ptr);
-    node->expand();
+    search_tree_t tree;
+    auto root = tree.root();
+    tree.expand(root, board, evaluator);
+
+    ASSERT_EQ(tree[root].value, 0);
+    ASSERT_EQ(tree[root].visit_count, 0);
+    auto edge = tree[root].first_edge;
+    auto child = tree.get_child(root, edge);
+    search_path_t path;
+    path.clear();
+    path.push(root, edge);
+    path.leaf = child;
+    tree.backpropagate(path, 1);
+
+    ASSERT_EQ(tree[child].visit_count, 1);
+    ASSERT_EQ(tree[child].value, 1);
+    ASSERT_EQ(tree.edges.visits[edge], 1);
+    ASSERT_EQ(tree.edges.values[edge], 1);
+    ASSERT_EQ(tree[root].value, -1);
+    ASSERT_EQ(tree[root].visit_count, 1);
+}
 
-    
-    ASSERT_EQ(node->value, 0);
-    ASSERT_EQ(node->visit_count, 0);
-    node->children[0]->backpropagate(1);
+TEST(TestArena, TestEdgesAreContiguous) {
+    chess::Board board;
+    search_tree_t tree;
+    auto root = tree.root();
+    auto first = tree.add_edges(root, {{chess::Move::make(chess::Square("e2"), chess::Square("e3")), 0.2},
+                                       {chess::Move::make(chess::Square("e2"), chess::Square("e4")), 0.8}});
+    ASSERT_EQ(tree.size(), 1);
+    ASSERT_EQ(tree.edges.size(), 2);
+
+    auto child = tree.get_child(root, first + 1);
+    ASSERT_EQ(tree.get_child(root, first + 1), child);
+    auto grandchild_edge = tree.add_edges(child, {{chess::Move::make(chess::Square("e7"), chess::Square("e5")), 1.0}});
+    auto grandchild = tree.get_child(child, grandchild_edge);
+
+    ASSERT_EQ(tree.size(), 3);
+    ASSERT_EQ(tree.edges.size(), 3);
+    ASSERT_EQ(tree[root].first_edge, first);
+    ASSERT_EQ(tree[root].num_edges, 2);
+    ASSERT_EQ(tree.edges.children[first], NULL_NODE);
+    ASSERT_EQ(tree[child].parent, root);
+    ASSERT_EQ(tree[child].parent_edge, first + 1);
+    ASSERT_EQ(tree[grandchild].parent, child);
+    ASSERT_FLOAT_EQ(tree.edges.priors[first + 1], 0.8);
+
+    tree.reset();
+    ASSERT_EQ(tree.size(), 1);
+    ASSERT_EQ(tree.edges.size(), 0);
+    ASSERT_FALSE(tree[tree.root()].is_expanded());
+}
 
-    ASSERT_EQ(node->children[0]->visit_count, 1);
-    ASSERT_EQ(node->children[0]->value, 1);
-    ASSERT_EQ(node->value, -1);
-    ASSERT_EQ(node->visit_count, 1);
+TEST(TestArena, TestBeginConcurrentAgainKeepsUsedSlots) {
+    search_tree_t tree;
+    auto root = tree.root();
+    tree.begin_concurrent(4, 4);
+    auto first = tree.add_edges(root, {{chess::Move::make(chess::Square("e2"), chess::Square("e4")), 1.0}});
+    auto child = tree.get_child(root, first);
+
+    // a second round only makes room, the nodes and edges of the first one stay
+    tree.begin_concurrent(100, 100);
+    ASSERT_TRUE(tree.is_concurrent());
+    ASSERT_EQ(tree.size(), 2);
+    ASSERT_EQ(tree.edges.children[first], child);
+    ASSERT_EQ(tree[child].parent, root);
+    ASSERT_EQ(tree.add_edges(child, {{chess::Move::make(chess::Square("e7"), chess::Square("e5")), 1.0}}), first + 1);
+
+    tree.end_concurrent();
+    ASSERT_FALSE(tree.is_concurrent());
+    ASSERT_EQ(tree.size(), 2);
+    ASSERT_EQ(tree.edges.size(), 2);
 }
 
 TEST(UcbScoreTest, UnvisitedChild) {
     chess::Board board;
-    std::shared_ptr<torch::nn::Module> model_ptr = std::make_shared<KotHModel>();
-    auto node = std::make_shared<node_t>(board, model_ptr);
-    node->visit_count = 1;
-    auto child = std::make_shared<node_t>(board, model_ptr, node, 0, 0.0);
-    ASSERT_FLOAT_EQ(node->ucb_score(child), 0.0);
-    
-    child = std::make_shared<node_t>(board, model_ptr, node, 0, 1.0);
-    ASSERT_FLOAT_EQ(node->ucb_score(child), 1.0);
-
-    child = std::make_shared<node_t>(board, model_ptr, node, 0, 0.5);
-    ASSERT_FLOAT_EQ(node->ucb_score(child), 0.5);
-
+    search_tree_t tree;
+    auto root = tree.root();
+    tree[root].visit_count = 1;
+    auto edge = tree.add_edges(root, {{0, 0.0}, {0, 1.0}, {0, 0.5}});
+    ASSERT_FLOAT_EQ(tree.ucb_score(root, edge), 0.0);
+    ASSERT_FLOAT_EQ(tree.ucb_score(root, edge + 1), 1.0);
+    ASSERT_FLOAT_EQ(tree.ucb_score(root, edge + 2), 0.5);
 }
 
 TEST(UcbScoreTest, VisitedChild) {
     chess::Board board;
-    std::shared_ptr<torch::nn::Module> model_ptr = std::make_shared<KotHModel>();
-    auto node = std::make_shared<node_t>(board, model_ptr);
-    node->visit_count = 1;
-    auto child = std::make_shared<node_t>(board, model_ptr, node, 0, 0.0);
-    child->visit_count = 1;
-    child->value = 1;
-    ASSERT_FLOAT_EQ(node->ucb_score(child), 0.0);
+    search_tree_t tree;
+    auto root = tree.root();
+    tree[root].visit_count = 1;
+    auto edge = tree.add_edges(root, {{0, 0.0}});
+    tree.edges.visits[edge] = 1;
+    tree.edges.values[edge] = 1;
+    ASSERT_FLOAT_EQ(tree.ucb_score(root, edge), 0.0);
 
-    child->value = 0;
-    ASSERT_FLOAT_EQ(node->ucb_score(child), 0.5);
+    tree.edges.values[edge] = 0;
+    ASSERT_FLOAT_EQ(tree.ucb_score(root, edge), 0.5);
 
-    child->value = 0.5;
-    ASSERT_FLOAT_EQ(node->ucb_score(child), 0.25);
+    tree.edges.values[edge] = 0.5;
+    ASSERT_FLOAT_EQ(tree.ucb_score(root, edge), 0.25);
 
-    child->value = 0.25;
-    ASSERT_FLOAT_EQ(node->ucb_score(child), 0.375);
+    tree.edges.values[edge] = 0.25;
+    ASSERT_FLOAT_EQ(tree.ucb_score(root, edge), 0.375);
 
-    node->visit_count = 16;
-    child->visit_count = 1;
-    child->value = 0;
-    child->prior = 0.5;
-    ASSERT_FLOAT_EQ(node->ucb_score(child), 1.5);
+    tree[root].visit_count = 16;
+    tree.edges.visits[edge] = 1;
+    tree.edges.values[edge] = 0;
+    tree.edges.priors[edge] = 0.5;
+    ASSERT_FLOAT_EQ(tree.ucb_score(root, edge), 1.5);
 
-    child->visit_count = 3;
-    ASSERT_FLOAT_EQ(node->ucb_score(child), 1);
+    tree.edges.visits[edge] = 3;
+    ASSERT_FLOAT_EQ(tree.ucb_score(root, edge), 1);
 
-    child->visit_count = 7;
-    ASSERT_FLOAT_EQ(node->ucb_score(child), 0.75);
+    tree.edges.visits[edge] = 7;
+    ASSERT_FLOAT_EQ(tree.ucb_score(root, edge), 0.75);
 
-    child->visit_count = 15;
-    ASSERT_FLOAT_EQ(node->ucb_score(child), 0.625);
+    tree.edges.visits[edge] = 15;
+    ASSERT_FLOAT_EQ(tree.ucb_score(root, edge), 0.625);
 }
 
 TEST(SelectBestChildTest, TestSelectBestChild) {
     chess::Board board;
-    std::shared_ptr<torch::nn::Module> model_ptr = std::make_shared<KotHModel>();
-    auto node = std::make_shared<node_t>(board, model_ptr);
-    node->visit_count = 1;
-    auto child1 = std::make_shared<node_t>(board, model_ptr, node, 0, 0.0);
-    auto child2 = std::make_shared<node_t>(board, model_ptr, node, 0, 1.0);
-    auto child3 = std::make_shared<node_t>(board, model_ptr, node, 0, 0.5);
-    node->children.push_back(child1);
-    node->children.push_back(child2);
-    node->children.push_back(child3);
+    search_tree_t tree;
+    auto root = tree.root();
+    tree[root].visit_count = 1;
+    auto edge = tree.add_edges(root, {{0, 0.0}, {0, 1.0}, {0, 0.5}});
 
-    ASSERT_EQ(node->select_best_child(), child2);
+    ASSERT_EQ(tree.select_best_child(root), edge + 1);
 }
 
 TEST(SelectBestLeafTest, TestSelectBestLeafOneLayer) {
     chess::Board board;
-    std::shared_ptr<torch::nn::Module> model_ptr = std::make_shared<KotHModel>();
-    auto node = std::make_shared<node_t>(board, model_ptr);
-    node->visit_count = 1;
-    auto child1 = std::make_shared<node_t>(board, model_ptr, node, chess::Move::make(chess::Square("e2"), chess::Square("e3")), 0.0);
-    auto child2 = std::make_shared<node_t>(board, model_ptr, node, chess::Move::make(chess::Square("e2"), chess::Square("e4")), 1.0);
-    auto child3 = std::make_shared<node_t>(board, model_ptr, node, chess::Move::make(chess::Square("d2"), chess::Square("d4")), 0.5);
-    node->children.push_back(child1);
-    node->children.push_back(child2);
-    node->children.push_back(child3);
-
-    auto leaf = node->select_best_leaf();
-    ASSERT_EQ(leaf, child2);
-    ASSERT_EQ(leaf->board.getFen(), "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1");
+    search_tree_t tree;
+    auto root = tree.root();
+    tree[root].visit_count = 1;
+    auto edge = tree.add_edges(root, {
+        {chess::Move::make(chess::Square("e2"), chess::Square("e3")), 0.0},
+        {chess::Move::make(chess::Square("e2"), chess::Square("e4")), 1.0},
+        {chess::Move::make(chess::Square("d2"), chess::Square("d4")), 0.5}
+    });
+
+    search_path_t path;
+    auto leaf = tree.select_best_leaf(board, path);
+    ASSERT_EQ(tree.edges.children[edge + 1], leaf);
+    ASSERT_EQ(tree.edges.children[edge], NULL_NODE);
+    ASSERT_EQ(board.getFen(), "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq - 0 1");
 }
 
 TEST(SelectBestLeafTest, TestSelectBestLeafTwoLayer) {
     chess::Board board;
-    std::shared_ptr<torch::nn::Module> model_ptr = std::make_shared<KotHModel>();
-    auto node = std::make_shared<node_t>(board, model_ptr);
-    node->visit_count = 1;
-    auto child1 = std::make_shared<node_t>(board, model_ptr, node, chess::Move::make(chess::Square("e2"), chess::Square("e3")), 0.0);
-    auto child2 = std::make_shared<node_t>(board, model_ptr, node, chess::Move::make(chess::Square("e2"), chess::Square("e4")), 1.0);
-    auto child3 = std::make_shared<node_t>(board, model_ptr, node, chess::Move::make(chess::Square("d2"), chess::Square("d4")), 0.5);
-    node->children.push_back(child1);
-    node->children.push_back(child2);
-    node->children.push_back(child3);
-
-    child1->visit_count = 1;
-    child3->visit_count = 1;
-    auto child21 = std::make_shared<node_t>(board, model_ptr, child2, chess::Move::make(chess::Square("e7"), chess::Square("e5")), 0.3);
-    auto child22 = std::make_shared<node_t>(board, model_ptr, child2, chess::Move::make(chess::Square("e7"), chess::Square("e6")), 0.3);
-    auto child23 = std::make_shared<node_t>(board, model_ptr, child2, chess::Move::make(chess::Square("d7"), chess::Square("d5")), 0.3);
-    child2->children.push_back(child21);
-    child2->children.push_back(child22);
-    child2->children.push_back(child23);
-
-    node->visit_count = 15;
-    child1->visit_count = 5;
-    child2->visit_count = 5;
-    child3->visit_count = 5;
-    child21->visit_count = 2;
-    child22->visit_count = 1;
-    child23->visit_count = 2;
-
-    auto leaf = node->select_best_leaf();
-    Logger::log(leaf->board.getFen());
-    ASSERT_EQ(leaf, child22);
-    ASSERT_EQ(leaf->board.getFen(), "rnbqkbnr/pppp1ppp/4p3/8/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2");
-}
\ No newline at end of file
+    search_tree_t tree;
+    auto root = tree.root();
+    auto edge1 = tree.add_edges(root, {
+        {chess::Move::make(chess::Square("e2"), chess::Square("e3")), 0.0},
+        {chess::Move::make(chess::Square("e2"), chess::Square("e4")), 1.0},
+        {chess::Move::make(chess::Square("d2"), chess::Square("d4")), 0.5}
+    });
+    auto edge2 = edge1 + 1;
+    auto edge3 = edge1 + 2;
+    auto child2 = tree.get_child(root, edge2);
+    auto edge21 = tree.add_edges(child2, {
+        {chess::Move::make(chess::Square("e7"), chess::Square("e5")), 0.3},
+        {chess::Move::make(chess::Square("e7"), chess::Square("e6")), 0.3},
+        {chess::Move::make(chess::Square("d7"), chess::Square("d5")), 0.3}
+    });
+    auto edge22 = edge21 + 1;
+    auto edge23 = edge21 + 2;
+
+    tree[root].visit_count = 15;
+    tree.edges.visits[edge1] = 5;
+    tree.edges.visits[edge2] = 5;
+    tree.edges.visits[edge3] = 5;
+    tree[child2].visit_count = 5;
+    tree.edges.visits[edge21] = 2;
+    tree.edges.visits[edge22] = 1;
+    tree.edges.visits[edge23] = 2;
+
+    search_path_t path;
+    auto leaf = tree.select_best_leaf(board, path);
+    Logger::log(board.getFen());
+    ASSERT_EQ(tree.edges.children[edge22], leaf);
+    ASSERT_EQ(board.getFen(), "rnbqkbnr/pppp1ppp/4p3/8/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2");
+}
+
+TEST(SelectBestLeafTest, TestUndoMoves) {
+    chess::Board board;
+    search_tree_t tree;
+    auto root = tree.root();
+    auto edge = tree.add_edges(root, {{chess::Move::make(chess::Square("e2"), chess::Square("e4")), 1.0}});
+    auto child = tree.get_child(root, edge);
+    edge = tree.add_edges(child, {{chess::Move::make(chess::Square("e7"), chess::Square("e5")), 1.0}});
+    tree[root].visit_count = 1;
+    tree[child].visit_count = 1;
+
+    auto hash = board.hash();
+    search_path_t path;
+    auto leaf = tree.select_best_leaf(board, path);
+    ASSERT_EQ(tree.edges.children[edge], leaf);
+    ASSERT_EQ(board.getFen(), "rnbqkbnr/pppp1ppp/8/4p3/4P3/8/PPPP1PPP/RNBQKBNR w KQkq - 0 2");
+
+    tree.undo_moves(path, board);
+    ASSERT_EQ(board.getFen(), chess::Board().getFen());
+    ASSERT_EQ(board.hash(), hash);
+}
+
+TEST(TestBackPropagate, TestBackPropagatePathFlipsSign) {
+    chess::Board board;
+    search_tree_t tree;
+    auto root = tree.root();
+    auto edge = tree.add_edges(root, {{chess::Move::make(chess::Square("e2"), chess::Square("e4")), 1.0}});
+    auto child = tree.get_child(root, edge);
+    auto child_edge = tree.add_edges(child, {{chess::Move::make(chess::Square("e7"), chess::Square("e5")), 1.0}});
+    tree[root].visit_count = 1;
+    tree[child].visit_count = 1;
+
+    search_path_t path;
+    auto leaf = tree.select_best_leaf(board, path);
+    ASSERT_EQ(path.size, 2);
+    ASSERT_EQ(path.steps[0].node, root);
+    ASSERT_EQ(path.steps[0].edge, edge);
+    ASSERT_EQ(path.steps[1].node, child);
+    ASSERT_EQ(path.steps[1].edge, child_edge);
+    ASSERT_EQ(path.leaf, leaf);
+
+    tree.backpropagate(path, 1);
+    ASSERT_EQ(tree[leaf].visit_count, 1);
+    ASSERT_EQ(tree[leaf].value, 1);
+    ASSERT_EQ(tree.edges.visits[child_edge], 1);
+    ASSERT_EQ(tree.edges.values[child_edge], 1);
+    ASSERT_EQ(tree[child].visit_count, 2);
+    ASSERT_EQ(tree[child].value, -1);
+    ASSERT_EQ(tree.edges.visits[edge], 1);
+    ASSERT_EQ(tree.edges.values[edge], -1);
+    ASSERT_EQ(tree[root].visit_count, 2);
+    ASSERT_EQ(tree[root].value, 1);
+}
+
+TEST(TestArena, TestRerootKeepsSubtree) {
+    chess::Board board;
+    search_tree_t tree;
+    auto root = tree.root();
+    auto edge = tree.add_edges(root, {{chess::Move::make(chess::Square("e2"), chess::Square("e4")), 0.6},
+                                      {chess::Move::make(chess::Square("d2"), chess::Square("d4")), 0.4}});
+    auto sibling = tree.get_child(root, edge + 1);
+    tree.add_edges(sibling, {{chess::Move::make(chess::Square("d7"), chess::Square("d5")), 1.0}});
+    auto child = tree.get_child(root, edge);
+    auto child_edge = tree.add_edges(child, {{chess::Move::make(chess::Square("e7"), chess::Square("e5")), 0.7},
+                                             {chess::Move::make(chess::Square("c7"), chess::Square("c5")), 0.3}});
+    auto grandchild = tree.get_child(child, child_edge + 1);
+    tree[child].visit_count = 3;
+    tree[child].value = -0.5;
+    tree.edges.visits[child_edge + 1] = 2;
+    tree.edges.values[child_edge + 1] = 0.25;
+    tree[grandchild].visit_count = 2;
+    ASSERT_EQ(tree.size(), 4);
+    ASSERT_EQ(tree.edges.size(), 5);
+
+    tree.reroot(child);
+
+    root = tree.root();
+    ASSERT_EQ(tree.size(), 2);
+    ASSERT_EQ(tree.edges.size(), 2);
+    ASSERT_EQ(tree[root].visit_count, 3);
+    ASSERT_FLOAT_EQ(tree[root].value, -0.5);
+    ASSERT_EQ(tree[root].parent, NULL_NODE);
+    ASSERT_EQ(tree[root].parent_edge, NULL_EDGE);
+    ASSERT_EQ(tree[root].num_edges, 2);
+    auto first = tree[root].first_edge;
+    ASSERT_EQ(tree.edges.moves[first], chess::Move::make(chess::Square("e7"), chess::Square("e5")));
+    ASSERT_FLOAT_EQ(tree.edges.priors[first], 0.7);
+    ASSERT_EQ(tree.edges.children[first], NULL_NODE);
+    ASSERT_EQ(tree.edges.visits[first + 1], 2);
+    ASSERT_FLOAT_EQ(tree.edges.values[first + 1], 0.25);
+    auto new_grandchild = tree.edges.children[first + 1];
+    ASSERT_NE(new_grandchild, NULL_NODE);
+    ASSERT_EQ(tree[new_grandchild].visit_count, 2);
+    ASSERT_EQ(tree[new_grandchild].parent, root);
+    ASSERT_EQ(tree[new_grandchild].parent_edge, first + 1);
+}
+
+TEST(TestVirtualLoss, TestVirtualLossIsReverted) {
+    search_tree_t tree;
+    auto root = tree.root();
+    tree.add_edges(root, {{chess::Move::make(chess::Square("e2"), chess::Square("e4")), 1.0}});
+    auto edge = tree[root].first_edge;
+    auto child = tree.get_child(root, edge);
+    search_path_t path;
+    path.clear();
+    path.push(root, edge);
+    path.leaf = child;
+
+    tree.add_virtual_loss(path, 1);
+    ASSERT_EQ(tree[root].visit_count, 1);
+    ASSERT_EQ(tree.edges.visits[edge], 1);
+    ASSERT_EQ(tree.edges.values[edge], 1);
+
+    tree.add_virtual_loss(path, -1);
+    ASSERT_EQ(tree[root].visit_count, 0);
+    ASSERT_EQ(tree.edges.visits[edge], 0);
+    ASSERT_EQ(tree.edges.values[edge], 0);
+}
+
+namespace {
+
+// expands index with the given moves, uniform priors
+edge_index_t add_uci_edges(search_tree_t& tree, node_index_t index, const chess::Board& board, const std::vector<std::string>& moves) {
+    search_tree_t::action_probs_t action_probs;
+    for (auto& move : moves) {
+        action_probs.emplace_back(chess::uci::uciToMove(board, move), 1.0f / moves.size());
+    }
+    return tree.add_edges(index, action_probs);
+}
+
+} // namespace
+
+TEST(TestGraph, TestTranspositionsShareNode) {
+    chess::Board board;
+    search_tree_t tree;
+    tree.set_graph(true);
+    search_path_t path;
+    tree.select_best_leaf(board, path);
+    auto root = tree.root();
+    auto first = add_uci_edges(tree, root, board, {"g1f3", "b1c3"});
+
+    board.makeMove(tree.edges.moves[first]);
+    auto knight_f3 = tree.get_child(root, first, board.hash());
+    auto reply = add_uci_edges(tree, knight_f3, board, {"b8c6"});
+    board.makeMove(tree.edges.moves[reply]);
+    auto knight_c6 = tree.get_child(knight_f3, reply, board.hash());
+    auto second = add_uci_edges(tree, knight_c6, board, {"b1c3"});
+    board.makeMove(tree.edges.moves[second]);
+    auto by_f3 = tree.get_child(knight_c6, second, board.hash());
+
+    chess::Board other;
+    other.makeMove(tree.edges.moves[first + 1]);
+    auto knight_c3 = tree.get_child(root, first + 1, other.hash());
+    auto other_reply = add_uci_edges(tree, knight_c3, other, {"b8c6"});
+    other.makeMove(tree.edges.moves[other_reply]);
+    auto other_c6 = tree.get_child(knight_c3, other_reply, other.hash());
+    auto other_second = add_uci_edges(tree, other_c6, other, {"g1f3"});
+    other.makeMove(tree.edges.moves[other_second]);
+    auto by_c3 = tree.get_child(other_c6, other_second, other.hash());
+
+    ASSERT_NE(knight_f3, knight_c3);
+    ASSERT_EQ(by_f3, by_c3);
+    ASSERT_EQ(tree[by_f3].parent, knight_c6);
+    // a transposition back to the root position
+    ASSERT_EQ(tree.get_child(root, first, chess::Board().hash()), knight_f3);
+}
+
+TEST(TestGraph, TestBackPropagateUsesChildQ) {
+    chess::Board board;
+    search_tree_t tree;
+    tree.set_graph(true);
+    auto root = tree.root();
+    auto edge = add_uci_edges(tree, root, board, {"e2e4", "d2d4"});
+    board.makeMove(tree.edges.moves[edge]);
+    auto child = tree.get_child(root, edge, board.hash());
+    // the child was already visited three times through another parent
+    tree[child].visit_count = 3;
+    tree[child].value = 1.5;
+
+    search_path_t path;
+    path.clear();
+    path.push(root, edge);
+    path.leaf = child;
+    tree.backpropagate(path, 0.5);
+
+    ASSERT_EQ(tree[child].visit_count, 4);
+    ASSERT_EQ(tree.edges.visits[edge], 1);
+    ASSERT_FLOAT_EQ(tree.edges.values[edge], 0.5);
+    ASSERT_FLOAT_EQ(tree[root].value, -0.5);
+}
+
+TEST(TestGraph, TestRerootCopiesSharedNodeOnce) {
+    chess::Board board;
+    search_tree_t tree;
+    tree.set_graph(true);
+    auto root = tree.root();
+    auto first = add_uci_edges(tree, root, board, {"e2e4"});
+    board.makeMove(tree.edges.moves[first]);
+    auto child = tree.get_child(root, first, board.hash());
+    auto replies = add_uci_edges(tree, child, board, {"g8f6", "b8c6"});
+    // two edges pointing at one node, as a transposition would
+    auto shared = tree.get_child(child, replies, 1234);
+    ASSERT_EQ(tree.get_child(child, replies + 1, 1234), shared);
+
+    tree.reroot(child);
+
+    ASSERT_EQ(tree.size(), 2);
+    auto new_root = tree.root();
+    auto new_first = tree[new_root].first_edge;
+    ASSERT_EQ(tree.edges.children[new_first], tree.edges.children[new_first + 1]);
+    ASSERT_EQ(tree.get_child(new_root, new_first, 1234), tree.edges.children[new_first]);
+}
+
+TEST(TestSolver, TestTerminalValueIsCached) {
+    // black is mated
+    chess::Board board("R5k1/5ppp/8/8/8/8/8/6K1 b - - 0 1");
+    search_tree_t tree;
+    auto root = tree.root();
+
+    ASSERT_EQ(tree.terminal_value(root, board), -1.0f);
+    ASSERT_EQ(tree[root].get_proof(), proof_t::LOSS);
+    // the cached proof is used without looking at the board again
+    ASSERT_EQ(tree.terminal_value(root, chess::Board()), -1.0f);
+}
+
+TEST(TestSolver, TestLostChildProvesParent) {
+    chess::Board board("6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1");
+    search_tree_t tree;
+    tree.set_solver(true);
+    auto root = tree.root();
+    auto first = add_uci_edges(tree, root, board, {"a1a2", "a1a8"});
+    board.makeMove(tree.edges.moves[first + 1]);
+    auto mated = tree.get_child(root, first + 1, board.hash());
+
+    search_path_t path;
+    path.clear();
+    path.push(root, first + 1);
+    path.leaf = mated;
+    tree.backpropagate(path, tree.terminal_value(mated, board).value());
+
+    ASSERT_EQ(tree[root].get_proof(), proof_t::WIN);
+    ASSERT_FLOAT_EQ(tree.edges.values[first + 1], -1.0);
+    ASSERT_EQ(tree.get_action(), tree.edges.moves[first + 1]);
+    // a proven node ends every descent
+    board.unmakeMove(tree.edges.moves[first + 1]);
+    ASSERT_EQ(tree.select_best_leaf(board, path), root);
+    ASSERT_EQ(path.size, 0);
+}
+
+TEST(TestSolver, TestAllChildrenProvenIsDraw) {
+    chess::Board board;
+    search_tree_t tree;
+    tree.set_solver(true);
+    auto root = tree.root();
+    auto first = add_uci_edges(tree, root, board, {"e2e4", "d2d4"});
+    auto drawn = tree.get_child(root, first);
+    auto won = tree.get_child(root, first + 1);
+    // stand-ins for proofs found deeper in the tree
+    tree[won].proof = proof_t::WIN;
+
+    search_path_t path;
+    path.clear();
+    path.push(root, first + 1);
+    path.leaf = won;
+    tree.backpropagate(path, 1.0);
+    ASSERT_EQ(tree[root].get_proof(), proof_t::UNKNOWN);
+
+    tree[drawn].proof = proof_t::DRAW;
+    path.clear();
+    path.push(root, first);
+    path.leaf = drawn;
+    tree.backpropagate(path, 0.0);
+    ASSERT_EQ(tree[root].get_proof(), proof_t::DRAW);
+}
+
+TEST(UcbScoreTest, SearchParams) {
+    search_tree_t tree;
+    auto root = tree.root();
+    tree[root].visit_count = 4;
+    tree[root].value = 2.0;
+    auto edge = tree.add_edges(root, {{0, 0.5}, {0, 0.5}});
+    auto child = tree.get_child(root, edge);
+    tree[child].visit_count = 4;
+    tree[child].value = -2.0;
+    auto grandchild_edge = tree.add_edges(child, {{0, 1.0}});
+
+    search_params_t params;
+    params.c_puct = 2.0;
+    params.fpu_absolute = false;
+    params.fpu_reduction = 0.5;
+    params.fpu_reduction_root = 0.25;
+    tree.set_params(params);
+    // Q of the root is 0.75 for its side to move, exploration 2 * sqrt(4) * 0.5
+    ASSERT_FLOAT_EQ(tree.ucb_score(root, edge), 0.5 + 2.0);
+    // Q of the child is 0.25 for its side to move
+    ASSERT_FLOAT_EQ(tree.ucb_score(child, grandchild_edge), -0.25 + 4.0);
+
+    params.fpu_absolute = true;
+    params.fpu_value = 0.0;
+    params.c_puct_factor = 1.0;
+    params.c_puct_base = 5.0;
+    tree.set_params(params);
+    // c_puct grows to 2 + log((4 + 5 + 1) / 5)
+    ASSERT_FLOAT_EQ(tree.ucb_score(root, edge), (2.0 + std::log(2.0)) * 2.0 * 0.5);
+}
+
+TEST(TestArena, TestCollectGarbageCollapsesLeastVisited) {
+    chess::Board board;
+    search_tree_t tree;
+    auto root = tree.root();
+    tree[root].visit_count = 10;
+    auto first = add_uci_edges(tree, root, board, {"e2e4", "d2d4"});
+    auto popular = tree.get_child(root, first);
+    auto rare = tree.get_child(root, first + 1);
+    tree[popular].visit_count = 8;
+    tree.edges.visits[first] = 8;
+    tree[rare].visit_count = 1;
+    tree.edges.visits[first + 1] = 1;
+    tree.edges.values[first + 1] = -1.0;
+    board.makeMove(tree.edges.moves[first]);
+    add_uci_edges(tree, popular, board, {"e7e5", "d7d5"});
+    board.unmakeMove(tree.edges.moves[first]);
+    board.makeMove(tree.edges.moves[first + 1]);
+    add_uci_edges(tree, rare, board, {"e7e5", "d7d5", "g8f6"});
+    auto before = tree.memory_usage();
+
+    // room for the root and the popular child only
+    tree.collect_garbage(2 * sizeof(node_t) + 4 * edges_t::BYTES_PER_EDGE);
+
+    ASSERT_EQ(tree.size(), 2);
+    ASSERT_LT(tree.memory_usage(), before);
+    ASSERT_LE(tree.memory_usage(), 2 * sizeof(node_t) + 4 * edges_t::BYTES_PER_EDGE);
+    auto new_first = tree[tree.root()].first_edge;
+    ASSERT_NE(tree.edges.children[new_first], NULL_NODE);
+    ASSERT_TRUE(tree[tree.edges.children[new_first]].is_expanded());
+    // the collapsed edge keeps its statistics
+    ASSERT_EQ(tree.edges.children[new_first + 1], NULL_NODE);
+    ASSERT_EQ(tree.edges.visits[new_first + 1], 1);
+    ASSERT_FLOAT_EQ(tree.edges.values[new_first + 1], -1.0);
+}
@@ -0,0 +1,98 @@
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "puct.h"
+
+namespace {
+
+struct children_t {
+    std::vector<float> priors;
+    std::vector<int> visits;
+    std::vector<float> values;
+};
+
+children_t random_children(int count, std::mt19937& gen) {
+    std::uniform_real_distribution<float> prior_dist(0.0, 1.0);
+    std::uniform_int_distribution<int> visit_dist(0, 50);
+    children_t children;
+    float sum = 0;
+    for (int i = 0; i < count; ++i) {
+        children.priors.push_back(prior_dist(gen));
+        sum += children.priors.back();
+        children.visits.push_back(visit_dist(gen) < 10 ? 0 : visit_dist(gen));
+        std::uniform_real_distribution<float> value_dist(-children.visits.back(), children.visits.back());
+        children.values.push_back(value_dist(gen));
+    }
+    for (auto& prior : children.priors) {
+        prior /= sum;
+    }
+    return children;
+}
+
+} // namespace
+
+TEST(PuctTest, EmptyNode) {
+    ASSERT_EQ(puct::select_scalar(nullptr, nullptr, nullptr, 0, 1.0, 0.5), -1);
+    ASSERT_EQ(puct::select_best(nullptr, nullptr, nullptr, 0, 1.0, 0.5), -1);
+}
+
+TEST(PuctTest, ScalarMatchesUcbScore) {
+    // the children of SelectBestChildTest and UcbScoreTest
+    std::vector<float> priors = {0.0, 1.0, 0.5};
+    std::vector<int> visits = {0, 0, 0};
+    std::vector<float> values = {0.0, 0.0, 0.0};
+    ASSERT_EQ(puct::select_scalar(priors.data(), visits.data(), values.data(), 3, 1.0, 0.5), 1);
+
+    visits = {1, 5, 1};
+    values = {-1.0, 5.0, 0.0};
+    ASSERT_EQ(puct::select_scalar(priors.data(), visits.data(), values.data(), 3, 1.0, 0.5), 0);
+}
+
+TEST(PuctTest, FirstPlayUrgency) {
+    // a visited child with Q = 0.75 against an unvisited one with a larger prior
+    std::vector<float> priors = {0.2, 0.4, 0.4};
+    std::vector<int> visits = {4, 0, 4};
+    std::vector<float> values = {-2.0, 0.0, 4.0};
+    for (int count : {3, 9}) {
+        priors.resize(count, 0.0);
+        visits.resize(count, 4);
+        values.resize(count, 4.0);
+        ASSERT_EQ(puct::select_best(priors.data(), visits.data(), values.data(), count, 1.0, 0.8), 1);
+        ASSERT_EQ(puct::select_best(priors.data(), visits.data(), values.data(), count, 1.0, 0.0), 0);
+    }
+}
+
+TEST(PuctTest, TiesPickFirstChild) {
+    for (int count : {3, 8, 9, 17, 40}) {
+        std::vector<float> priors(count, 1.0f / count);
+        std::vector<int> visits(count, 0);
+        std::vector<float> values(count, 0.0);
+        ASSERT_EQ(puct::select_scalar(priors.data(), visits.data(), values.data(), count, 1.0, 0.5), 0);
+        ASSERT_EQ(puct::select_best(priors.data(), visits.data(), values.data(), count, 1.0, 0.5), 0);
+
+        priors[count - 1] = 2.0f / count;
+        priors[count / 2] = 2.0f / count;
+        ASSERT_EQ(puct::select_best(priors.data(), visits.data(), values.data(), count, 1.0, 0.5), count / 2);
+    }
+}
+
+TEST(PuctTest, DispatchedKernelMatchesScalar) {
+    std::mt19937 gen(42);
+    for (int count = 1; count <= 80; ++count) {
+        for (int repeat = 0; repeat < 50; ++repeat) {
+            auto children = random_children(count, gen);
+            float exploration = 1.0 * std::sqrt(static_cast<float>(repeat * 7 + 1));
+            float unvisited_q = 0.25f * (repeat % 5);
+            auto expected = puct::select_scalar(children.priors.data(), children.visits.data(), children.values.data(), count, exploration, unvisited_q);
+            ASSERT_EQ(puct::select_best(children.priors.data(), children.visits.data(), children.values.data(), count, exploration, unvisited_q), expected);
+#ifdef PUCT_HAS_AVX2_KERNEL
+            if (puct::has_avx2()) {
+                ASSERT_EQ(puct::select_avx2(children.priors.data(), children.visits.data(), children.values.data(), count, exploration, unvisited_q), expected);
+            }
+#endif
+        }
+    }
+}
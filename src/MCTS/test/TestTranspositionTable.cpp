@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+
+#include "chess/chess.hpp"
+#include "transposition_table.h"
+
+namespace {
+
+transposition_table_t::action_probs_t uniform_policy(const chess::Movelist& moves) {
+    transposition_table_t::action_probs_t action_probs;
+    for (const auto& move : moves) {
+        action_probs.emplace_back(move, 1.0f / moves.size());
+    }
+    return action_probs;
+}
+
+} // namespace
+
+TEST(TestTranspositionTable, TestStoreAndProbe) {
+    transposition_table_t table(1 << 20);
+    chess::Board board;
+    chess::Movelist moves;
+    chess::movegen::legalmoves(moves, board);
+    auto policy = uniform_policy(moves);
+    policy[3].second = 0.5;
+
+    transposition_table_t::action_probs_t action_probs;
+    float value;
+    ASSERT_FALSE(table.probe(board.hash(), moves, action_probs, value));
+
+    table.store(board.hash(), policy, 0.25);
+    ASSERT_TRUE(table.probe(board.hash(), moves, action_probs, value));
+    ASSERT_EQ(action_probs.size(), moves.size());
+    for (size_t i = 0; i < policy.size(); ++i) {
+        ASSERT_EQ(action_probs[i].first, policy[i].first);
+        ASSERT_NEAR(action_probs[i].second, policy[i].second, 1e-4);
+    }
+    ASSERT_EQ(value, 0.25);
+    ASSERT_EQ(table.size(), 1);
+
+    table.clear();
+    ASSERT_FALSE(table.probe(board.hash(), moves, action_probs, value));
+    ASSERT_EQ(table.size(), 0);
+}
+
+TEST(TestTranspositionTable, TestTranspositionsShareEntry) {
+    transposition_table_t table(1 << 20);
+    chess::Board first;
+    chess::Board second;
+    for (auto move : {"g1f3", "g8f6", "b1c3"}) {
+        first.makeMove(chess::uci::uciToMove(first, move));
+    }
+    for (auto move : {"b1c3", "g8f6", "g1f3"}) {
+        second.makeMove(chess::uci::uciToMove(second, move));
+    }
+    chess::Movelist moves;
+    chess::movegen::legalmoves(moves, first);
+    table.store(first.hash(), uniform_policy(moves), -0.5);
+
+    transposition_table_t::action_probs_t action_probs;
+    float value;
+    ASSERT_TRUE(table.probe(second.hash(), moves, action_probs, value));
+    ASSERT_EQ(value, -0.5);
+}
+
+TEST(TestTranspositionTable, TestMemoryIsBounded) {
+    size_t budget = 64 << 10;
+    transposition_table_t table(budget);
+    ASSERT_LE(table.memory_usage(), budget);
+
+    chess::Board board;
+    chess::Movelist moves;
+    chess::movegen::legalmoves(moves, board);
+    auto policy = uniform_policy(moves);
+    // many more positions than fit, keys of a random walk would collide in the same way
+    for (uint64_t key = 1; key <= 100000; ++key) {
+        table.store(key * 0x9E3779B97F4A7C15ull, policy, 0.0);
+    }
+    ASSERT_LE(table.size(), table.capacity());
+    ASSERT_LE(table.memory_usage(), budget);
+
+    // the newest entry survives, the oldest ones were replaced
+    transposition_table_t::action_probs_t action_probs;
+    float value;
+    ASSERT_TRUE(table.probe(100000 * 0x9E3779B97F4A7C15ull, moves, action_probs, value));
+    ASSERT_FALSE(table.probe(1 * 0x9E3779B97F4A7C15ull, moves, action_probs, value));
+}
+
+TEST(TestTranspositionTable, TestCollisionWithOtherPosition) {
+    transposition_table_t table(1 << 20);
+    chess::Board board;
+    chess::Movelist moves;
+    chess::movegen::legalmoves(moves, board);
+    table.store(42, uniform_policy(moves), 0.0);
+
+    chess::Board other("4k3/8/8/8/8/8/8/4K3 w - - 0 1");
+    chess::Movelist other_moves;
+    chess::movegen::legalmoves(other_moves, other);
+    transposition_table_t::action_probs_t action_probs;
+    float value;
+    ASSERT_FALSE(table.probe(42, other_moves, action_probs, value));
+}
+
+TEST(TestTranspositionTable, TestCollisionWithSameMoveCount) {
+    transposition_table_t table(1 << 20);
+    chess::Board board;
+    chess::Movelist moves;
+    chess::movegen::legalmoves(moves, board);
+    table.store(42, uniform_policy(moves), 0.0);
+
+    // the mirrored opening position has as many moves, but other ones
+    chess::Board other("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR b KQkq - 0 1");
+    chess::Movelist other_moves;
+    chess::movegen::legalmoves(other_moves, other);
+    ASSERT_EQ(other_moves.size(), moves.size());
+    transposition_table_t::action_probs_t action_probs;
+    float value;
+    ASSERT_FALSE(table.probe(42, other_moves, action_probs, value));
+}
+
+TEST(TestTranspositionTable, TestStoreAgainReplacesEntry) {
+    transposition_table_t table(1 << 20);
+    chess::Board board;
+    chess::Movelist moves;
+    chess::movegen::legalmoves(moves, board);
+    table.store(board.hash(), uniform_policy(moves), 0.25);
+    table.store(board.hash(), uniform_policy(moves), -0.75);
+
+    ASSERT_EQ(table.size(), 1);
+    transposition_table_t::action_probs_t action_probs;
+    float value;
+    ASSERT_TRUE(table.probe(board.hash(), moves, action_probs, value));
+    ASSERT_EQ(value, -0.75);
+}
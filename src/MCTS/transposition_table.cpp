@@ -0,0 +1,137 @@
+#include "transposition_table.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+constexpr float QUANTIZATION = std::numeric_limits<uint16_t>::max();
+
+// roughly the bytes an average position needs in each buffer
+constexpr size_t EXPECTED_MOVES = 40;
+
+// FNV-1a over the raw moves, folded to 16 bits
+template <typename Moves, typename Get>
+uint16_t hash_moves(const Moves& moves, Get get) {
+    uint32_t hash = 2166136261u;
+    for (const auto& item : moves) {
+        hash = (hash ^ get(item).move()) * 16777619u;
+    }
+    return static_cast<uint16_t>(hash ^ (hash >> 16));
+}
+
+} // namespace
+
+transposition_table_t::transposition_table_t(size_t bytes) {
+    resize(bytes);
+}
+
+void transposition_table_t::resize(size_t bytes) {
+    size_t bytes_per_position = sizeof(entry_t) + EXPECTED_MOVES * sizeof(uint16_t);
+    // a power of two, so the bucket of a key is a mask
+    size_t num_slots = std::bit_floor(std::max(BUCKET_SIZE, bytes / bytes_per_position));
+    size_t entry_bytes = num_slots * sizeof(entry_t);
+    // the ring holds at least one policy of the widest position
+    size_t ring_size = std::max<size_t>(chess::constants::MAX_MOVES, (bytes - std::min(bytes, entry_bytes)) / sizeof(uint16_t));
+
+    this->entries.assign(num_slots, entry_t{});
+    this->entries.shrink_to_fit();
+    this->policies.assign(ring_size, 0);
+    this->policies.shrink_to_fit();
+    this->policy_end = 0;
+    this->num_entries = 0;
+}
+
+void transposition_table_t::clear() {
+    std::fill(this->entries.begin(), this->entries.end(), entry_t{});
+    this->policy_end = 0;
+    this->num_entries = 0;
+}
+
+size_t transposition_table_t::memory_usage() const {
+    return this->entries.size() * sizeof(entry_t) + this->policies.size() * sizeof(uint16_t);
+}
+
+bool transposition_table_t::is_live(const entry_t& entry) const {
+    return entry.num_moves > 0 && this->policy_end - entry.policy_start <= this->policies.size();
+}
+
+bool transposition_table_t::probe(uint64_t key, const chess::Movelist& legal_moves, action_probs_t& action_probs, float& value) const {
+    size_t mask = this->entries.size() - 1;
+    size_t bucket = key & mask & ~(BUCKET_SIZE - 1);
+    for (size_t i = 0; i < BUCKET_SIZE; ++i) {
+        auto& entry = this->entries[bucket + i];
+        if (entry.key != key || !this->is_live(entry)) {
+            continue;
+        }
+        if (entry.num_moves != legal_moves.size() ||
+            entry.moves_hash != hash_moves(legal_moves, [](const chess::Move& move) { return move; })) {
+            // a hash collision with another position
+            return false;
+        }
+        size_t start = entry.policy_start % this->policies.size();
+        action_probs.clear();
+        for (int j = 0; j < legal_moves.size(); ++j) {
+            action_probs.emplace_back(legal_moves[j], this->policies[start + j] / QUANTIZATION);
+        }
+        value = entry.value;
+        return true;
+    }
+    return false;
+}
+
+void transposition_table_t::store(uint64_t key, const action_probs_t& action_probs, float value) {
+    if (action_probs.empty()) {
+        return;
+    }
+    size_t mask = this->entries.size() - 1;
+    size_t bucket = key & mask & ~(BUCKET_SIZE - 1);
+    // the slot of the key if it is in the bucket, so it is never stored twice,
+    // else the first empty or stale slot, else the oldest entry
+    entry_t* target = nullptr;
+    for (size_t i = 0; i < BUCKET_SIZE; ++i) {
+        auto& entry = this->entries[bucket + i];
+        if (entry.key == key && entry.num_moves > 0) {
+            target = &entry;
+            break;
+        }
+    }
+    for (size_t i = 0; i < BUCKET_SIZE && target == nullptr; ++i) {
+        auto& entry = this->entries[bucket + i];
+        if (!this->is_live(entry)) {
+            target = &entry;
+        }
+    }
+    if (target == nullptr) {
+        target = &this->entries[bucket];
+        for (size_t i = 1; i < BUCKET_SIZE; ++i) {
+            auto& entry = this->entries[bucket + i];
+            if (entry.policy_start < target->policy_start) {
+                target = &entry;
+            }
+        }
+    }
+    if (target->num_moves == 0) {
+        this->num_entries++;
+    }
+
+    // a policy never wraps around the end of the ring
+    size_t ring_size = this->policies.size();
+    if (this->policy_end % ring_size + action_probs.size() > ring_size) {
+        this->policy_end += ring_size - this->policy_end % ring_size;
+    }
+    size_t start = this->policy_end % ring_size;
+    for (size_t j = 0; j < action_probs.size(); ++j) {
+        // a legal move keeps a non zero prior after quantization
+        float prior = std::clamp(action_probs[j].second, 0.0f, 1.0f);
+        this->policies[start + j] = static_cast<uint16_t>(std::max(1l, std::lround(prior * QUANTIZATION)));
+    }
+
+    target->key = key;
+    target->policy_start = this->policy_end;
+    target->value = value;
+    target->num_moves = static_cast<uint16_t>(action_probs.size());
+    target->moves_hash = hash_moves(action_probs, [](const auto& action_prob) { return action_prob.first; });
+    this->policy_end += action_probs.size();
+}
@@ -0,0 +1,73 @@
+#include "chess/chess.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+
+#ifndef MCTS_TRANSPOSITION_TABLE_H
+#define MCTS_TRANSPOSITION_TABLE_H
+
+// Network evaluations keyed by the Zobrist hash of the position, in a fixed
+// memory budget.
+//
+// The entries are an open-addressed table probed in buckets of BUCKET_SIZE
+// slots. The policy of an entry is kept apart in a ring buffer of quantized
+// priors, one per legal move in move generation order, so an entry costs only
+// as much as its position has moves. Writing to the ring overwrites the
+// oldest policies, the entries pointing at them become stale and are reused
+// first. When a bucket has no empty or stale slot the oldest entry is replaced.
+// A hit also has to match the number and a 16 bit hash of the legal moves, which
+// turns most key collisions between different positions into misses.
+//
+// The key is Board::hash(), which leaves out the halfmove clock. Positions that
+// only differ in their clock share an entry, although the network sees the
+// clock as an input, a deliberate trade of that small input for more hits.
+//
+// The table is not synchronized, the owner guards it.
+class transposition_table_t
+{
+public:
+    typedef std::vector<std::pair<chess::Move, float>> action_probs_t;
+
+    static constexpr size_t DEFAULT_BYTES = 64ull << 20;
+    static constexpr size_t BUCKET_SIZE = 4;
+
+    explicit transposition_table_t(size_t bytes = DEFAULT_BYTES);
+
+    // drops every entry and splits the budget between entries and policies
+    void resize(size_t bytes);
+    void clear();
+
+    // legal_moves are the moves of the position in move generation order
+    bool probe(uint64_t key, const chess::Movelist& legal_moves, action_probs_t& action_probs, float& value) const;
+    // action_probs has to be in move generation order, as the network thread builds it
+    void store(uint64_t key, const action_probs_t& action_probs, float value);
+
+    // occupied slots, stale entries included
+    size_t size() const { return num_entries; }
+    size_t capacity() const { return entries.size(); }
+    size_t memory_usage() const;
+
+private:
+    struct entry_t
+    {
+        uint64_t key;
+        // position of the policy in the ring, counted since the last clear
+        uint64_t policy_start;
+        float value;
+        // 0 for an empty slot, an evaluated position always has a legal move
+        uint16_t num_moves;
+        // hash of the legal moves in move generation order, fills the padding of the entry
+        uint16_t moves_hash;
+    };
+
+    bool is_live(const entry_t& entry) const;
+
+    std::vector<entry_t> entries;
+    std::vector<uint16_t> policies;
+    uint64_t policy_end = 0;
+    size_t num_entries = 0;
+};
+
+#endif // MCTS_TRANSPOSITION_TABLE_H
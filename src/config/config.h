@@ -3,6 +3,10 @@
 #include <chrono>
 #include <fstream>
 #include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #ifndef CONFIG_H
 #define CONFIG_H
@@ -22,11 +26,133 @@ struct Config {
 
     struct MCTSConfig {
         int num_simulations = 100;
+        // simulations per move over the training run, iterations count from 1:
+        // "constant" always runs num_simulations, "ramp" starts at num_simulations
+        // and adds simulations_per_iteration every iteration up to max_simulations
+        // (0 for no cap), "table" takes simulation_table[iteration - 1] and keeps
+        // the last entry for later iterations
+        std::string simulation_schedule = "constant";
+        int simulations_per_iteration = 0;
+        int max_simulations = 0;
+        std::vector<int> simulation_table;
+        // playout cap randomization: a move gets the full budget with
+        // full_search_probability and fast_simulations otherwise, only full
+        // searches are policy targets. 0 fast_simulations disables it
+        int fast_simulations = 0;
+        float full_search_probability = 0.25;
+        // further limits of a single search, 0 disables
+        int max_nodes = 0;
+        int max_time_ms = 0;
+        // memory budget of the search tree, the least visited subtrees are collapsed
+        // down to gc_keep_fraction of it once it is used up, 0 disables
+        size_t max_tree_bytes = 0;
+        float gc_keep_fraction = 0.5;
+        // time managed searches stop between time_min_factor and time_max_factor
+        // of their target time, the more spread the root visits the later
+        float time_min_factor = 0.5;
+        float time_max_factor = 2.0;
+        // moves the remaining clock has to last for, and the time lost per move outside the search
+        int time_moves_to_go = 30;
+        int move_overhead_ms = 30;
+        // leaves collected with virtual loss and evaluated together per simulation batch
+        int search_batch_size = 1;
+        // threads descending the same tree, each gathers its own batches
+        int search_threads = 1;
+        // c_puct, grown with the parent visits N by c_puct_factor * log((N + c_puct_base + 1) / c_puct_base)
         float exploration_constant = 1.0;
+        float c_puct_base = 19652.0;
+        float c_puct_factor = 0.0;
+        // first play urgency, the Q of unvisited children: "absolute" uses fpu_value,
+        // "reduction" the Q of the parent minus fpu_reduction (fpu_reduction_root at the root)
+        std::string fpu_strategy = "absolute";
+        float fpu_value = 0.5;
+        float fpu_reduction = 0.0;
+        float fpu_reduction_root = 0.0;
+        bool reuse_tree = true;
+        // "puct", or "gumbel" to pick the root move by Gumbel top-k sampling and
+        // sequential halving, single threaded only
+        std::string root_selection = "puct";
+        // root moves sampled by the Gumbel root
+        int gumbel_top_k = 16;
+        // sigma(q) = (gumbel_c_visit + max visits) * gumbel_c_scale * q
+        float gumbel_c_visit = 50.0;
+        float gumbel_c_scale = 1.0;
+        // share one node between transpositions, single threaded only
+        bool graph_search = false;
+        // propagate proven wins, losses and draws up the tree, not used in graph search
+        bool solver = false;
+        // stop once the most visited root move can no longer be overtaken. Off for
+        // self play, a stopped search leaves a sharper policy target than its budget
+        bool early_stop = false;
+        // also stop when the root visit distribution moved less than this KL
+        // divergence since the last checkpoint, 0 disables
+        float early_stop_kl_threshold = 0.0;
+        // simulations between two KL checkpoints
+        int kl_check_interval = 100;
+        // memory budget of the evaluation cache shared by all searches
+        size_t transposition_table_bytes = 64ull << 20;
 
         void load_config(const nlohmann::json &json_config) {
             num_simulations = lookup(json_config, "num_simulations", num_simulations);
+            simulation_schedule = lookup(json_config, "simulation_schedule", simulation_schedule);
+            simulations_per_iteration = lookup(json_config, "simulations_per_iteration", simulations_per_iteration);
+            max_simulations = lookup(json_config, "max_simulations", max_simulations);
+            simulation_table = lookup(json_config, "simulation_table", simulation_table);
+            fast_simulations = lookup(json_config, "fast_simulations", fast_simulations);
+            full_search_probability = lookup(json_config, "full_search_probability", full_search_probability);
+            max_nodes = lookup(json_config, "max_nodes", max_nodes);
+            max_time_ms = lookup(json_config, "max_time_ms", max_time_ms);
+            max_tree_bytes = lookup(json_config, "max_tree_bytes", max_tree_bytes);
+            gc_keep_fraction = lookup(json_config, "gc_keep_fraction", gc_keep_fraction);
+            time_min_factor = lookup(json_config, "time_min_factor", time_min_factor);
+            time_max_factor = lookup(json_config, "time_max_factor", time_max_factor);
+            time_moves_to_go = lookup(json_config, "time_moves_to_go", time_moves_to_go);
+            move_overhead_ms = lookup(json_config, "move_overhead_ms", move_overhead_ms);
+            search_batch_size = lookup(json_config, "search_batch_size", search_batch_size);
+            search_threads = lookup(json_config, "search_threads", search_threads);
             exploration_constant = lookup(json_config, "exploration_constant", exploration_constant);
+            c_puct_base = lookup(json_config, "c_puct_base", c_puct_base);
+            c_puct_factor = lookup(json_config, "c_puct_factor", c_puct_factor);
+            fpu_strategy = lookup(json_config, "fpu_strategy", fpu_strategy);
+            fpu_value = lookup(json_config, "fpu_value", fpu_value);
+            fpu_reduction = lookup(json_config, "fpu_reduction", fpu_reduction);
+            fpu_reduction_root = lookup(json_config, "fpu_reduction_root", fpu_reduction_root);
+            reuse_tree = lookup(json_config, "reuse_tree", reuse_tree);
+            root_selection = lookup(json_config, "root_selection", root_selection);
+            gumbel_top_k = lookup(json_config, "gumbel_top_k", gumbel_top_k);
+            gumbel_c_visit = lookup(json_config, "gumbel_c_visit", gumbel_c_visit);
+            gumbel_c_scale = lookup(json_config, "gumbel_c_scale", gumbel_c_scale);
+            graph_search = lookup(json_config, "graph_search", graph_search);
+            solver = lookup(json_config, "solver", solver);
+            early_stop = lookup(json_config, "early_stop", early_stop);
+            early_stop_kl_threshold = lookup(json_config, "early_stop_kl_threshold", early_stop_kl_threshold);
+            kl_check_interval = lookup(json_config, "kl_check_interval", kl_check_interval);
+            transposition_table_bytes = lookup(json_config, "transposition_table_bytes", transposition_table_bytes);
+
+            if (simulation_schedule != "constant" && simulation_schedule != "ramp" && simulation_schedule != "table") {
+                throw std::runtime_error("Unknown simulation schedule: " + simulation_schedule);
+            }
+            if (fpu_strategy != "absolute" && fpu_strategy != "reduction") {
+                throw std::runtime_error("Unknown first play urgency strategy: " + fpu_strategy);
+            }
+            if (root_selection != "puct" && root_selection != "gumbel") {
+                throw std::runtime_error("Unknown root selection: " + root_selection);
+            }
+            if (simulation_schedule == "table" && simulation_table.empty()) {
+                throw std::runtime_error("The table simulation schedule needs a simulation_table");
+            }
+        }
+
+        int simulations(int iteration) const {
+            int index = std::max(iteration, 1) - 1;
+            if (simulation_schedule == "ramp") {
+                int simulations = num_simulations + simulations_per_iteration * index;
+                return max_simulations > 0 ? std::min(simulations, max_simulations) : simulations;
+            }
+            if (simulation_schedule == "table" && !simulation_table.empty()) {
+                return simulation_table[std::min<size_t>(index, simulation_table.size() - 1)];
+            }
+            return num_simulations;
         }
     };
     
@@ -37,6 +163,13 @@ struct Config {
         int64_t policy_head_filters;
         int64_t value_head_filters;
         int64_t reduction_ratio;
+        // "cpu", "cuda" or "cuda:<index>", where the model runs, in self play and in training
+        std::string device = "cuda";
+        // threads of a forward pass on the CPU, 0 keeps the torch default
+        int cpu_threads = 0;
+        // self play runs a copy of the model with the batch norms folded into the convolutions.
+        // Off until bench_fold has shown matching outputs and a speedup
+        bool fold_batch_norm = false;
 
         void load_config(const nlohmann::json &json_config) {
             in_channels = 19;
@@ -45,6 +178,13 @@ struct Config {
             policy_head_filters = lookup(json_config, "policy_head_filters", 256);
             value_head_filters = lookup(json_config, "value_head_filters", 256);
             reduction_ratio = lookup(json_config, "reduction_ratio", 16);
+            device = lookup(json_config, "device", device);
+            cpu_threads = lookup(json_config, "cpu_threads", cpu_threads);
+            fold_batch_norm = lookup(json_config, "fold_batch_norm", fold_batch_norm);
+
+            if (device != "cpu" && device != "cuda" && device.rfind("cuda:", 0) != 0) {
+                throw std::runtime_error("Unknown device: " + device);
+            }
         }
     };
     
@@ -56,11 +196,30 @@ struct Config {
             int num_iterations = 1000;
             int num_games_per_iteration = 1024;
             int max_threads = 1024;
+            // games played at once on one thread by self_play_lockstep, which runs one forward pass per
+            // round of their leaves. 0, the default, plays every game on its own thread of a max_threads
+            // pool, answered by the inference server
+            int lockstep_games = 0;
+            // the model thread evaluates up to inference_batch_size positions at once, and waits at
+            // most inference_max_wait_us after the first queued position for the batch to fill
+            int inference_batch_size = 256;
+            int inference_max_wait_us = 500;
+            // picks the batch size up to inference_batch_size with the best measured throughput
+            bool adaptive_batch_size = true;
+            // threads running the network, and threads turning its output into priors
+            int inference_workers = 2;
+            int inference_post_workers = 1;
 
             void load_config(const nlohmann::json &json_config) {
                 num_iterations = lookup(json_config, "num_iterations", num_iterations);
                 num_games_per_iteration = lookup(json_config, "num_games_per_iteration", num_games_per_iteration);
                 max_threads = lookup(json_config, "max_threads", max_threads);
+                lockstep_games = lookup(json_config, "lockstep_games", lockstep_games);
+                inference_batch_size = lookup(json_config, "inference_batch_size", inference_batch_size);
+                inference_max_wait_us = lookup(json_config, "inference_max_wait_us", inference_max_wait_us);
+                adaptive_batch_size = lookup(json_config, "adaptive_batch_size", adaptive_batch_size);
+                inference_workers = lookup(json_config, "inference_workers", inference_workers);
+                inference_post_workers = lookup(json_config, "inference_post_workers", inference_post_workers);
             }
         };
         
@@ -34,7 +34,7 @@ ChessDataSet::ChessDataSet(std::vector<ChessData> data, int max_size) : _max_siz
 }*/
 
 ChessTensorData ChessDataSet::get_batch(std::vector<long unsigned> indices) {
-    std::vector<torch::Tensor> inputs, policies, values;
+    std::vector<torch::Tensor> inputs, policies, values, policy_masks;
     for (auto index : indices) {
         if (index >= _queue.size()) {
             throw std::runtime_error("Index out of range");
@@ -48,8 +48,9 @@ ChessTensorData ChessDataSet::get_batch(std::vector<long unsigned> indices) {
         inputs.push_back(input_tensor);
         policies.push_back(policy_tensor);
         values.push_back(value_tensor);
+        policy_masks.push_back(torch::tensor(data.full_search ? 1.0f : 0.0f));
     }
-    return {torch::stack(inputs), torch::stack(policies), torch::stack(values)};
+    return {torch::stack(inputs), torch::stack(policies), torch::stack(values), torch::stack(policy_masks)};
 }
 
   
@@ -74,16 +75,19 @@ void ChessDataSet::save(const std::string& path) const {
     }
     json j;
     std::vector<std::string> fens;
+    std::vector<bool> full_search;
     std::vector<torch::Tensor> policies, values;
     
     for (int i = 0; i < _queue.size(); ++i) {
         auto data = _queue[i];
         fens.push_back(data.fen);
+        full_search.push_back(data.full_search);
         policies.push_back(data.policy);
         values.push_back(data.value);
     }
     
     j["fens"] = fens;
+    j["full_search"] = full_search;
     
     std::ofstream fout(path + "_meta.json");
     fout << j.dump(4);
@@ -112,6 +116,8 @@ void ChessDataSet::load(const std::string& path) {
     fin.close();
 
     std::vector<std::string> fens = j["fens"];
+    // datasets saved before playout cap randomization only hold full searches
+    std::vector<bool> full_search = j.contains("full_search") ? j["full_search"].get<std::vector<bool>>() : std::vector<bool>(fens.size(), true);
 
     // Load policy and value tensors
     torch::Tensor policies, values;
@@ -120,7 +126,7 @@ void ChessDataSet::load(const std::string& path) {
 
     // Split batched tensors into individual samples
     for (size_t i = 0; i < fens.size(); ++i) {
-        _queue.push({fens[i], policies[i], values[i]});
+        _queue.push({fens[i], policies[i], values[i], full_search[i]});
     }
 
     Logger::log("Loaded dataset from " + path);
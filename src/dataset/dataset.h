@@ -8,12 +8,17 @@ struct ChessData {
     std::string fen;
     torch::Tensor policy;
     torch::Tensor value;
+    // false for moves played with the fast search of playout cap randomization,
+    // their policy is not a training target, only their value
+    bool full_search = true;
 };
 
 struct ChessTensorData {
     torch::Tensor input;
     torch::Tensor policy;
     torch::Tensor value;
+    // 1 where the policy is a training target, 0 otherwise
+    torch::Tensor policy_mask;
 };
 
 /*
@@ -0,0 +1,81 @@
+// Checks and times the batch norm folding of LCZero on the CPU. The batch
+// norms of a small network get running statistics from a few random batches
+// in training mode, then the folded copy is compared with the network in eval
+// mode on another random batch and both are timed. Exits with 1 if an output
+// differs by more than the tolerance, relative to the largest policy logit.
+//
+// usage: bench_fold [batch_size] [iterations] [blocks] [filters]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+#include "config.h"
+#include "model.h"
+
+namespace {
+
+constexpr float TOLERANCE = 1e-4;
+
+double seconds_per_batch(LCZero& model, const torch::Tensor& input, int iterations) {
+    c10::InferenceMode inference_mode;
+    model.forward(input);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        model.forward(input);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int batch_size = argc > 1 ? std::atoi(argv[1]) : 64;
+    int iterations = argc > 2 ? std::atoi(argv[2]) : 20;
+
+    config::Config::NetworkConfig network_config;
+    network_config.in_channels = 19;
+    network_config.num_blocks = argc > 3 ? std::atoi(argv[3]) : 6;
+    network_config.num_filters = argc > 4 ? std::atoi(argv[4]) : 64;
+    network_config.policy_head_filters = 32;
+    network_config.value_head_filters = 32;
+    network_config.reduction_ratio = 8;
+    network_config.device = "cpu";
+
+    torch::manual_seed(0);
+    auto model = std::make_shared<LCZero>(network_config);
+    model->train();
+    {
+        torch::NoGradGuard no_grad;
+        for (int i = 0; i < 8; ++i) {
+            model->forward(torch::randn({batch_size, 19, 8, 8}));
+        }
+    }
+    model->eval();
+    auto folded = std::make_shared<LCZero>(network_config);
+    folded->load_folded(*model);
+    folded->eval();
+
+    auto input = torch::randn({batch_size, 19, 8, 8});
+    float policy_error = 0;
+    float value_error = 0;
+    {
+        c10::InferenceMode inference_mode;
+        auto [policy, value] = model->forward(input);
+        auto [folded_policy, folded_value] = folded->forward(input);
+        // relative to the largest output, the logits are not bounded
+        policy_error = ((policy - folded_policy).abs().max() / policy.abs().max().clamp_min(1)).item<float>();
+        value_error = (value - folded_value).abs().max().item<float>();
+    }
+
+    auto model_seconds = seconds_per_batch(*model, input, iterations);
+    auto folded_seconds = seconds_per_batch(*folded, input, iterations);
+    std::printf("batch size: %d, network: %ldx%ld\n", batch_size, network_config.num_blocks, network_config.num_filters);
+    std::printf("max error: policy %.2e (relative), value %.2e\n", policy_error, value_error);
+    std::printf("%10s %12s %8s\n", "model", "positions/s", "speedup");
+    std::printf("%10s %12.0f %7.2fx\n", "batch norm", batch_size / model_seconds, 1.0);
+    std::printf("%10s %12.0f %7.2fx\n", "folded", batch_size / folded_seconds, model_seconds / folded_seconds);
+    return std::max(policy_error, value_error) > TOLERANCE ? 1 : 0;
+}
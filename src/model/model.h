@@ -12,6 +12,31 @@
 #ifndef MODEL_H
 #define MODEL_H
 
+// Copies the parameters and buffers of source into the module of the same
+// architecture, across devices. Only registered submodules are copied.
+inline void copy_parameters(torch::nn::Module& module, const torch::nn::Module& source) {
+    torch::NoGradGuard no_grad;
+    auto source_parameters = source.named_parameters();
+    for (auto& parameter : module.named_parameters()) {
+        parameter.value().copy_(source_parameters[parameter.key()]);
+    }
+    auto source_buffers = source.named_buffers();
+    for (auto& buffer : module.named_buffers()) {
+        buffer.value().copy_(source_buffers[buffer.key()]);
+    }
+}
+
+// Sets the weights of conv to those of source followed by the batch norm bn
+// in eval mode: every output channel is scaled by gamma / sqrt(var + eps) and
+// shifted by beta - mean * scale.
+inline void fold_batch_norm(torch::nn::Conv2d& conv, const torch::nn::Conv2d& source, const torch::nn::BatchNorm2d& bn) {
+    torch::NoGradGuard no_grad;
+    auto scale = bn->weight / torch::sqrt(bn->running_var + bn->options.eps());
+    auto bias = source->options.bias() ? source->bias : torch::zeros_like(bn->running_mean);
+    conv->weight.copy_(source->weight * scale.view({-1, 1, 1, 1}));
+    conv->bias.copy_((bias - bn->running_mean) * scale + bn->bias);
+}
+
 class SEBlock : public torch::nn::Module {
     public:
         SEBlock(int64_t in_channels, int64_t reduction_ratio = 16) {
@@ -33,6 +58,10 @@ class SEBlock : public torch::nn::Module {
         void to(torch::Device device) {
             _sequential->to(device);
         }
+
+        void load(const SEBlock& source) {
+            copy_parameters(*_sequential, *source._sequential);
+        }
     private:
         torch::nn::Sequential _sequential;
 };
@@ -59,15 +88,29 @@ class ResBlock : public torch::nn::Module {
 
         torch::Tensor forward(torch::Tensor x) {
             auto identity = x;
-            x = _conv1->forward(x);
-            x = _bn1->forward(x);
-            x = _relu->forward(x);
-            x = _conv2->forward(x);
-            x = _bn2->forward(x);
+            if (_folded) {
+                // the convolution output is a fresh tensor, so the ReLU runs in place
+                x = torch::relu_(_conv1->forward(x));
+                x = _conv2->forward(x);
+            } else {
+                x = _conv1->forward(x);
+                x = _bn1->forward(x);
+                x = _relu->forward(x);
+                x = _conv2->forward(x);
+                x = _bn2->forward(x);
+            }
             x = _se_block->forward(x);
             return x + identity;
         }
 
+        // the weights of source with its batch norms folded into the convolutions, for inference only
+        void load_folded(const ResBlock& source) {
+            fold_batch_norm(_conv1, source._conv1, source._bn1);
+            fold_batch_norm(_conv2, source._conv2, source._bn2);
+            _se_block->load(*source._se_block);
+            _folded = true;
+        }
+
         void to(torch::Device device) {
             _conv1->to(device);
             _bn1->to(device);
@@ -83,6 +126,8 @@ class ResBlock : public torch::nn::Module {
         torch::nn::Conv2d _conv2 = nullptr;
         torch::nn::BatchNorm2d _bn2 = nullptr;
         torch::nn::ModuleHolder<SEBlock> _se_block = nullptr;
+        // set by load_folded, the batch norms are skipped
+        bool _folded = false;
 };
 
 class ResNet : public torch::nn::Module {
@@ -103,6 +148,12 @@ class ResNet : public torch::nn::Module {
         void to(torch::Device device) {
             _residual_blocks->to(device);
         }
+
+        void load_folded(const ResNet& source) {
+            for (size_t i = 0; i < _residual_blocks->size(); i++) {
+                _residual_blocks->ptr<ResBlock>(i)->load_folded(*source._residual_blocks->ptr<ResBlock>(i));
+            }
+        }
     private:
         torch::nn::Sequential _residual_blocks;
 };
@@ -124,6 +175,12 @@ class PolicyHead : public torch::nn::Module {
             _conv1->to(device);
             _conv2->to(device);
         }
+
+        // the layers are not registered, so they are copied one by one
+        void load(const PolicyHead& source) {
+            copy_parameters(*_conv1, *source._conv1);
+            copy_parameters(*_conv2, *source._conv2);
+        }
     private:
         torch::nn::Conv2d _conv1 = nullptr;
         torch::nn::Conv2d _conv2 = nullptr;
@@ -152,6 +209,12 @@ class ValueHead : public torch::nn::Module {
             _conv2->to(device);
             _fc->to(device);
         }
+
+        void load(const ValueHead& source) {
+            copy_parameters(*_conv1, *source._conv1);
+            copy_parameters(*_conv2, *source._conv2);
+            copy_parameters(*_fc, *source._fc);
+        }
     private:
         torch::nn::Conv2d _conv1 = nullptr;
         torch::nn::Conv2d _conv2 = nullptr;
@@ -161,7 +224,7 @@ class ValueHead : public torch::nn::Module {
 
 class LCZero : public torch::nn::Module {
     public:
-        LCZero(const config::Config::NetworkConfig& config) {
+        LCZero(const config::Config::NetworkConfig& config) : _device(config.device) {
             _conv = torch::nn::Conv2d(torch::nn::Conv2dOptions(config.in_channels, config.num_filters, 3).padding(1));
             _resnet = torch::nn::ModuleHolder<ResNet>(config.num_filters, config.num_filters, config.num_blocks, config.reduction_ratio);
             _relu = torch::nn::ReLU();
@@ -171,11 +234,13 @@ class LCZero : public torch::nn::Module {
             register_module("resnet", _resnet);
             register_module("policy_head", _policy_head);
             register_module("value_head", _value_head);
+            // the weights start on the configured device, forward moves the inputs there
+            to(_device);
         }
 
         std::tuple<torch::Tensor, torch::Tensor> forward(torch::Tensor x) {
-            if (x.device() != torch::kCUDA) {
-                x = x.to(torch::kCUDA);
+            if (x.device() != _device) {
+                x = x.to(_device);
             }
             x = _conv->forward(x);
             x = _resnet->forward(x);
@@ -196,9 +261,26 @@ class LCZero : public torch::nn::Module {
             _resnet->to(device);
             _policy_head->to(device);
             _value_head->to(device);
+            _device = device;
+        }
+
+        // where the weights live, inputs are moved there by forward
+        torch::Device device() const { return _device; }
+
+        // Makes this model an inference copy of source, which has the same
+        // config: the batch norms of the residual blocks are folded into their
+        // convolutions, so the outputs match those of source in eval mode and
+        // the model must not be trained.
+        void load_folded(const LCZero& source) {
+            copy_parameters(*_conv, *source._conv);
+            _resnet->load_folded(*source._resnet);
+            _policy_head->load(*source._policy_head);
+            _value_head->load(*source._value_head);
         }
 
     private:
+        // where the weights are, the configured device until the model is moved with to()
+        torch::Device _device;
         torch::nn::Conv2d _conv = nullptr;
         torch::nn::ModuleHolder<ResNet> _resnet = nullptr;
         torch::nn::ReLU _relu;
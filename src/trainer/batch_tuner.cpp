@@ -0,0 +1,70 @@
+#include "batch_tuner.h"
+#include <algorithm>
+
+batch_tuner_t::batch_tuner_t(size_t max_batch_size, bool adaptive, unsigned int explore_interval)
+    : adaptive(adaptive), explore_interval(std::max(1u, explore_interval)) {
+    max_batch_size = std::max<size_t>(1, max_batch_size);
+    for (size_t batch_size = 1; batch_size < max_batch_size; batch_size *= 2) {
+        this->buckets.push_back({batch_size});
+    }
+    this->buckets.push_back({max_batch_size});
+    this->best = this->buckets.size() - 1;
+}
+
+size_t batch_tuner_t::next_batch_size() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (!this->adaptive) {
+        return this->buckets.back().batch_size;
+    }
+    for (auto& bucket : this->buckets) {
+        if (bucket.batches == 0) {
+            return bucket.batch_size;
+        }
+    }
+    if (++this->batches % this->explore_interval != 0 || this->buckets.size() == 1) {
+        return this->buckets[this->best].batch_size;
+    }
+    // alternates between the smaller and the larger neighbour of the best size
+    this->explore_up = !this->explore_up;
+    size_t neighbour = this->best;
+    if (this->explore_up ? this->best + 1 < this->buckets.size() : this->best == 0) {
+        neighbour++;
+    } else {
+        neighbour--;
+    }
+    return this->buckets[neighbour].batch_size;
+}
+
+void batch_tuner_t::record(size_t batch_size, size_t positions, float seconds) {
+    if (positions == 0 || seconds <= 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(this->mutex);
+    auto bucket = std::find_if(this->buckets.begin(), this->buckets.end(),
+        [batch_size](const bucket_t& bucket) { return bucket.batch_size == batch_size; });
+    if (bucket == this->buckets.end()) {
+        return;
+    }
+    float positions_per_second = positions / seconds;
+    if (bucket->batches == 0) {
+        bucket->positions_per_second = positions_per_second;
+    } else {
+        bucket->positions_per_second += AVERAGE_WEIGHT * (positions_per_second - bucket->positions_per_second);
+    }
+    bucket->batches++;
+
+    // untried sizes count as 0 positions per second
+    auto fastest = std::max_element(this->buckets.begin(), this->buckets.end(),
+        [](const bucket_t& a, const bucket_t& b) { return a.positions_per_second < b.positions_per_second; });
+    this->best = fastest - this->buckets.begin();
+}
+
+size_t batch_tuner_t::best_batch_size() const {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return this->buckets[this->best].batch_size;
+}
+
+std::vector<batch_tuner_t::bucket_t> batch_tuner_t::curve() const {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return this->buckets;
+}
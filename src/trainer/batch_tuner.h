@@ -0,0 +1,51 @@
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+
+#ifndef BATCH_TUNER_H
+#define BATCH_TUNER_H
+
+// Picks the batch size of the model thread from the measured throughput.
+//
+// The candidates are the powers of two up to max_batch_size. Each one is
+// tried once, then the model thread asks for the candidate with the highest
+// average positions per second, and every explore_interval batches for one of
+// its neighbours instead, so the choice follows the hardware and the load.
+// A batch is timed from the moment it leaves the queue until its output is
+// on the host: encoding, forward pass and copy, without the idle time spent
+// waiting for positions or the post-processing.
+class batch_tuner_t
+{
+public:
+    struct bucket_t
+    {
+        size_t batch_size;
+        // moving average over the batches taken with this size
+        float positions_per_second = 0.0;
+        unsigned int batches = 0;
+    };
+
+    // without adaptive, next_batch_size() is always max_batch_size
+    batch_tuner_t(size_t max_batch_size, bool adaptive, unsigned int explore_interval = 16);
+
+    size_t next_batch_size();
+    // a batch asked for with batch_size evaluated positions in seconds
+    void record(size_t batch_size, size_t positions, float seconds);
+    // the candidate with the highest throughput so far
+    size_t best_batch_size() const;
+    std::vector<bucket_t> curve() const;
+
+private:
+    static constexpr float AVERAGE_WEIGHT = 0.1;
+
+    mutable std::mutex mutex;
+    std::vector<bucket_t> buckets;
+    bool adaptive;
+    unsigned int explore_interval;
+    unsigned int batches = 0;
+    size_t best = 0;
+    bool explore_up = true;
+};
+
+#endif // BATCH_TUNER_H
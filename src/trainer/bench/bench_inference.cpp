@@ -0,0 +1,121 @@
+// Throughput benchmark of the inference server on the CPU. A small LCZero
+// answers the positions that producer threads submit to the inference queue,
+// the way the searches of self play do, for 1, 2 and 4 workers. Every
+// producer submits batch_size positions at once and waits for all of them.
+//
+// usage: bench_inference [positions] [batch_size] [producers] [blocks] [filters] [cpu_threads]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "chess/chess.hpp"
+#include "config.h"
+#include "model.h"
+#include "inference_queue.h"
+#include "inference_server.h"
+#include "batch_tuner.h"
+#include "trainer.h"
+
+namespace {
+
+struct position_t
+{
+    uint64_t key;
+    std::string fen;
+    chess::Movelist moves;
+};
+
+// positions of random games, at most one per ply of every game
+std::vector<position_t> random_positions(int count) {
+    std::mt19937 generator(42);
+    std::vector<position_t> positions;
+    while (static_cast<int>(positions.size()) < count) {
+        chess::Board board;
+        for (int ply = 0; ply < 80 && static_cast<int>(positions.size()) < count; ++ply) {
+            chess::Movelist moves;
+            chess::movegen::legalmoves(moves, board);
+            if (moves.empty()) {
+                break;
+            }
+            positions.push_back({board.hash(), board.getFen(), moves});
+            board.makeMove(moves[generator() % moves.size()]);
+        }
+    }
+    return positions;
+}
+
+double bench(std::shared_ptr<LCZero> model, const std::vector<position_t>& positions, int workers, int batch_size, int producers) {
+    memory::clear();
+    inference_queue_t queue;
+    batch_tuner_t tuner(batch_size, false);
+    config::Config::TrainerConfig::SelfPlayConfig config;
+    config.inference_batch_size = batch_size;
+    config.inference_workers = workers;
+    config.inference_post_workers = std::max(1, workers / 2);
+    inference_server_t server(model, queue, tuner, config);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int producer = 0; producer < producers; ++producer) {
+        threads.emplace_back([&, producer]() {
+            std::vector<std::shared_future<inference_result_t>> results;
+            for (size_t first = producer * batch_size; first < positions.size(); first += producers * batch_size) {
+                results.clear();
+                for (size_t i = first; i < std::min(first + batch_size, positions.size()); ++i) {
+                    results.push_back(queue.submit(positions[i].key, positions[i].fen, positions[i].moves));
+                }
+                for (auto& result : results) {
+                    result.wait();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return positions.size() / elapsed;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int num_positions = argc > 1 ? std::atoi(argv[1]) : 8192;
+    int batch_size = argc > 2 ? std::atoi(argv[2]) : 64;
+    int producers = argc > 3 ? std::atoi(argv[3]) : 8;
+
+    config::Config::NetworkConfig network_config;
+    network_config.in_channels = 19;
+    network_config.num_blocks = argc > 4 ? std::atoi(argv[4]) : 4;
+    network_config.num_filters = argc > 5 ? std::atoi(argv[5]) : 64;
+    network_config.policy_head_filters = 32;
+    network_config.value_head_filters = 32;
+    network_config.reduction_ratio = 8;
+    network_config.device = "cpu";
+    network_config.cpu_threads = argc > 6 ? std::atoi(argv[6]) : 0;
+    if (network_config.cpu_threads > 0) {
+        at::set_num_threads(network_config.cpu_threads);
+    }
+    auto model = std::make_shared<LCZero>(network_config);
+    model->eval();
+    auto positions = random_positions(num_positions);
+
+    std::printf("positions: %d, batch size: %d, producers: %d, network: %ldx%ld\n",
+        num_positions, batch_size, producers, network_config.num_blocks, network_config.num_filters);
+    std::printf("%8s %14s %8s\n", "workers", "positions/s", "speedup");
+    double single = 0;
+    for (int workers : {1, 2, 4}) {
+        auto rate = bench(model, positions, workers, batch_size, producers);
+        if (workers == 1) {
+            single = rate;
+        }
+        std::printf("%8d %14.0f %7.2fx\n", workers, rate, rate / single);
+    }
+    return 0;
+}
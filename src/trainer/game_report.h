@@ -3,6 +3,10 @@
 #include <vector>
 #include <nlohmann/json.hpp>
 
+
+#ifndef GAME_REPORT_H
+#define GAME_REPORT_H
+
 using json = nlohmann::json;
 
 struct Child {
@@ -28,6 +32,9 @@ struct MoveReport {
     std::string move;
     std::vector<Child> children;
     float value;
+    int simulations;
+    int saved_simulations;
+    bool full_search;
 
     json to_json() const {
         json j;
@@ -38,6 +45,9 @@ struct MoveReport {
             j["children"].push_back(child.to_json());
         }
         j["value"] = value;
+        j["simulations"] = simulations;
+        j["saved_simulations"] = saved_simulations;
+        j["full_search"] = full_search;
         return j;
     }
 };
@@ -66,4 +76,6 @@ struct GameReport {
             throw std::runtime_error("Could not open file: " + path);
         }
     }
-};
\ No newline at end of file
+};
+
+#endif // GAME_REPORT_H
@@ -0,0 +1,44 @@
+#include "inference_queue.h"
+#include <algorithm>
+
+std::shared_future<inference_result_t> inference_queue_t::submit(uint64_t key, const std::string& fen, const chess::Movelist& moves) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    auto it = this->pending.find(key);
+    if (it != this->pending.end()) {
+        return it->second;
+    }
+    this->queue.push_back({key, fen, moves, {}});
+    auto result = this->queue.back().result.get_future().share();
+    this->pending.emplace(key, result);
+    lock.unlock();
+    this->condition.notify_one();
+    return result;
+}
+
+std::vector<board_request_t> inference_queue_t::take_batch(size_t batch_size, std::chrono::microseconds max_wait, std::stop_token stop) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (!this->condition.wait(lock, stop, [this]() { return !this->queue.empty(); })) {
+        return {};
+    }
+    this->condition.wait_for(lock, stop, max_wait, [this, batch_size]() { return this->queue.size() >= batch_size; });
+
+    std::vector<board_request_t> batch;
+    size_t count = std::min(batch_size, this->queue.size());
+    batch.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        batch.push_back(std::move(this->queue.front()));
+        this->queue.pop_front();
+    }
+    return batch;
+}
+
+void inference_queue_t::complete(board_request_t& request, inference_result_t result) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    request.result.set_value(std::move(result));
+    this->pending.erase(request.key);
+}
+
+size_t inference_queue_t::size() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    return this->queue.size();
+}
@@ -0,0 +1,59 @@
+#include "chess/chess.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+#ifndef INFERENCE_QUEUE_H
+#define INFERENCE_QUEUE_H
+
+// The network output for one position, the priors in the order of its moves.
+struct inference_result_t
+{
+    std::vector<std::pair<chess::Move, float>> action_probs;
+    float value = 0.0;
+};
+
+// A position waiting for the network thread, key is its Zobrist hash.
+struct board_request_t
+{
+    uint64_t key;
+    std::string fen;
+    // generated by the search, in the order the priors are returned
+    chess::Movelist moves;
+    std::promise<inference_result_t> result;
+};
+
+// Positions waiting for the network. Searches submit positions and wait on
+// the returned future; a position already waiting is not queued twice, its
+// requesters share one future. The network thread sleeps in take_batch()
+// until a position arrives, then gathers positions until it has batch_size of
+// them or max_wait has passed, so a lone request is answered within max_wait
+// and a busy queue is drained in full batches.
+class inference_queue_t
+{
+public:
+    std::shared_future<inference_result_t> submit(uint64_t key, const std::string& fen, const chess::Movelist& moves);
+    // empty once stop is requested
+    std::vector<board_request_t> take_batch(size_t batch_size, std::chrono::microseconds max_wait, std::stop_token stop);
+    // answers a request taken by take_batch, a later submit of its position queues it again
+    void complete(board_request_t& request, inference_result_t result);
+    size_t size();
+
+private:
+    std::mutex mutex;
+    std::condition_variable_any condition;
+    std::deque<board_request_t> queue;
+    // the future of every position queued or being computed, by key
+    std::unordered_map<uint64_t, std::shared_future<inference_result_t>> pending;
+};
+
+#endif // INFERENCE_QUEUE_H
@@ -0,0 +1,127 @@
+#include "inference_server.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "board_utils.h"
+#include "trainer.h"
+
+std::vector<std::pair<chess::Move, float>> legal_action_probs(const float* policy, const chess::Movelist& moves) {
+    std::vector<std::pair<chess::Move, float>> action_probs;
+    action_probs.reserve(moves.size());
+    float max_logit = -std::numeric_limits<float>::infinity();
+    for (auto move : moves) {
+        action_probs.emplace_back(move, policy[utils::move_to_idx(move)]);
+        max_logit = std::max(max_logit, action_probs.back().second);
+    }
+    float sum = 0;
+    for (auto& action_prob : action_probs) {
+        action_prob.second = std::exp(action_prob.second - max_logit);
+        sum += action_prob.second;
+    }
+    for (auto& action_prob : action_probs) {
+        action_prob.second /= sum;
+    }
+    return action_probs;
+}
+
+inference_server_t::inference_server_t(
+    std::shared_ptr<LCZero> model,
+    inference_queue_t& queue,
+    batch_tuner_t& tuner,
+    const config::Config::TrainerConfig::SelfPlayConfig& config
+) : model(model), queue(queue), tuner(tuner) {
+    this->max_batch_size = std::max(1, config.inference_batch_size);
+    this->max_wait = std::chrono::microseconds(config.inference_max_wait_us);
+    for (int i = 0; i < std::max(1, config.inference_post_workers); ++i) {
+        this->post_workers.emplace_back([this](std::stop_token stop) { run_post_worker(stop); });
+    }
+    for (int i = 0; i < std::max(1, config.inference_workers); ++i) {
+        this->workers.emplace_back([this](std::stop_token stop) { run_worker(stop); });
+    }
+}
+
+inference_server_t::~inference_server_t() {
+    // the post workers drain the outputs of the stopped workers before they stop
+    this->workers.clear();
+    this->post_workers.clear();
+}
+
+void inference_server_t::set_model(std::shared_ptr<LCZero> model) {
+    std::unique_lock<std::mutex> lock(this->model_mutex);
+    this->model = model;
+}
+
+std::shared_ptr<LCZero> inference_server_t::get_model() {
+    std::unique_lock<std::mutex> lock(this->model_mutex);
+    return this->model;
+}
+
+void inference_server_t::run_worker(std::stop_token stop) {
+    // no autograd and no version counters, the outputs are only read
+    c10::InferenceMode inference_mode;
+    // reused by every batch of the worker
+    auto input_tensor = torch::zeros({static_cast<long>(this->max_batch_size), 19, 8, 8});
+    while (!stop.stop_requested()) {
+        auto batch_size = std::min(this->tuner.next_batch_size(), this->max_batch_size);
+        auto requests = this->queue.take_batch(batch_size, this->max_wait, stop);
+        if (requests.empty()) {
+            continue;
+        }
+        // the tuner measures the network alone, waiting for work or for the post workers is not its cost
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < requests.size(); i++) {
+            auto board = chess::Board(requests[i].fen);
+            input_tensor[i] = utils::board_to_tensor(board);
+        }
+        // forward moves the input to the device of the model
+        auto output = get_model()->forward(input_tensor.narrow(0, 0, static_cast<long>(requests.size())));
+
+        output_t host_output;
+        host_output.requests = std::move(requests);
+        // contiguous host copies, the post workers read them through raw pointers
+        host_output.policy = std::get<0>(output).to(torch::kCPU).contiguous();
+        host_output.value = std::get<1>(output).to(torch::kCPU).contiguous();
+        std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+        this->tuner.record(batch_size, host_output.requests.size(), elapsed.count());
+        {
+            std::unique_lock<std::mutex> lock(this->outputs_mutex);
+            this->outputs.push_back(std::move(host_output));
+        }
+        this->outputs_condition.notify_one();
+    }
+}
+
+void inference_server_t::run_post_worker(std::stop_token stop) {
+    auto& memory_instance = memory::getInstance();
+    while (true) {
+        output_t output;
+        {
+            std::unique_lock<std::mutex> lock(this->outputs_mutex);
+            if (!this->outputs_condition.wait(lock, stop, [this]() { return !this->outputs.empty(); })) {
+                return;
+            }
+            output = std::move(this->outputs.front());
+            this->outputs.pop_front();
+        }
+
+        auto& requests = output.requests;
+        // one row of logits and one value per request, no tensor op or sync per move
+        const float* policy = output.policy.data_ptr<float>();
+        const float* value = output.value.data_ptr<float>();
+        auto row_size = output.policy.size(1);
+        std::vector<inference_result_t> results;
+        results.reserve(requests.size());
+        for (size_t i = 0; i < requests.size(); i++) {
+            results.push_back({legal_action_probs(policy + i * row_size, requests[i].moves), value[i]});
+        }
+        {
+            std::unique_lock<std::mutex> lock(memory_instance.transposition_table_mutex);
+            for (size_t i = 0; i < requests.size(); i++) {
+                memory_instance.transposition_table.store(requests[i].key, results[i].action_probs, results[i].value);
+            }
+        }
+        for (size_t i = 0; i < requests.size(); i++) {
+            this->queue.complete(requests[i], std::move(results[i]));
+        }
+    }
+}
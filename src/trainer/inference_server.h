@@ -0,0 +1,75 @@
+#include <torch/torch.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "chess/chess.hpp"
+#include "model.h"
+#include "config.h"
+#include "inference_queue.h"
+#include "batch_tuner.h"
+
+
+#ifndef INFERENCE_SERVER_H
+#define INFERENCE_SERVER_H
+
+// The priors of the legal moves from one row of policy logits in host memory, softmaxed over the legal moves only.
+std::vector<std::pair<chess::Move, float>> legal_action_probs(const float* policy, const chess::Movelist& moves);
+
+// Answers the positions of an inference queue with the network.
+//
+// inference_workers threads take batches from the queue, encode them into an
+// input buffer of their own and run the forward pass, so one worker encodes
+// the next batch while another waits for the network: with two workers the
+// input is double buffered. The outputs are copied to the host and handed to
+// inference_post_workers threads, which softmax the policies over the legal
+// moves, store the results in the transposition table of memory and answer
+// the futures, so no forward pass waits for the post-processing of the last.
+class inference_server_t
+{
+public:
+    inference_server_t(
+        std::shared_ptr<LCZero> model,
+        inference_queue_t& queue,
+        batch_tuner_t& tuner,
+        const config::Config::TrainerConfig::SelfPlayConfig& config
+    );
+    // stops the workers, the outputs they produced are still answered
+    ~inference_server_t();
+
+    void set_model(std::shared_ptr<LCZero> model);
+
+private:
+    // the contiguous host copy of the network output for a batch, waiting for post-processing
+    struct output_t
+    {
+        std::vector<board_request_t> requests;
+        torch::Tensor policy;
+        torch::Tensor value;
+    };
+
+    void run_worker(std::stop_token stop);
+    void run_post_worker(std::stop_token stop);
+    std::shared_ptr<LCZero> get_model();
+
+    std::mutex model_mutex;
+    std::shared_ptr<LCZero> model;
+    inference_queue_t& queue;
+    batch_tuner_t& tuner;
+    size_t max_batch_size;
+    std::chrono::microseconds max_wait;
+
+    std::mutex outputs_mutex;
+    std::condition_variable_any outputs_condition;
+    std::deque<output_t> outputs;
+    std::vector<std::jthread> post_workers;
+    std::vector<std::jthread> workers;
+};
+
+#endif // INFERENCE_SERVER_H
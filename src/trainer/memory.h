@@ -1,14 +1,15 @@
 
 
 
+#include "transposition_table.h"
+#include "inference_queue.h"
+
 class memory
 {
 public:
-    std::unordered_map<std::string, std::pair<node_t::action_probs_t, float>> action_probs_map{};
-    std::vector<std::string> boards_to_compute{};
-    std::vector<std::string> processing{};
-    std::mutex boards_to_compute_and_processing_mutex;
-    std::mutex action_probs_map_mutex;
+    transposition_table_t transposition_table{};
+    inference_queue_t inference_queue;
+    std::mutex transposition_table_mutex;
 
     static memory& getInstance() {
         static memory instance;
@@ -17,11 +18,8 @@ public:
 
     static void clear() {
         auto& instance = getInstance();
-        std::lock_guard<std::mutex> lock(instance.boards_to_compute_and_processing_mutex);
-        std::lock_guard<std::mutex> lock2(instance.action_probs_map_mutex);
-        instance.action_probs_map.clear();
-        instance.boards_to_compute.clear();
-        instance.processing.clear();
+        std::lock_guard<std::mutex> lock(instance.transposition_table_mutex);
+        instance.transposition_table.clear();
     }
     memory(const memory&) = delete;
     memory& operator=(const memory&) = delete;
@@ -0,0 +1,57 @@
+#include "model_evaluator.h"
+#include <chrono>
+#include <mutex>
+#include "board_utils.h"
+#include "inference_server.h"
+#include "trainer.h"
+
+model_evaluator_t::model_evaluator_t(std::shared_ptr<LCZero> model) : model(model) {}
+
+void model_evaluator_t::evaluate(std::vector<evaluation_t>& batch) {
+    auto& memory_instance = memory::getInstance();
+
+    // another search may have stored a position since it was probed
+    std::vector<size_t> missing;
+    {
+        std::unique_lock<std::mutex> lock(memory_instance.transposition_table_mutex);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (!memory_instance.transposition_table.probe(batch[i].key, batch[i].moves, batch[i].action_probs, batch[i].value)) {
+                missing.push_back(i);
+            }
+        }
+    }
+    if (missing.empty()) {
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto input_tensor = torch::zeros({static_cast<long>(missing.size()), 19, 8, 8});
+    for (size_t i = 0; i < missing.size(); ++i) {
+        auto board = chess::Board(batch[missing[i]].fen);
+        input_tensor[i] = utils::board_to_tensor(board);
+    }
+    // inference tensors skip autograd and version tracking
+    c10::InferenceMode inference_mode;
+    auto output = this->model->forward(input_tensor);
+    auto policy_tensor = std::get<0>(output).to(torch::kCPU).contiguous();
+    auto value_tensor = std::get<1>(output).to(torch::kCPU).contiguous();
+
+    // one row of logits and one value per position, read in host memory
+    const float* policy = policy_tensor.data_ptr<float>();
+    const float* value = value_tensor.data_ptr<float>();
+    auto row_size = policy_tensor.size(1);
+    for (size_t i = 0; i < missing.size(); ++i) {
+        auto& evaluation = batch[missing[i]];
+        evaluation.action_probs = legal_action_probs(policy + i * row_size, evaluation.moves);
+        evaluation.value = value[i];
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    this->num_batches++;
+    this->num_positions += missing.size();
+    this->total_seconds += elapsed.count();
+
+    std::unique_lock<std::mutex> lock(memory_instance.transposition_table_mutex);
+    for (auto i : missing) {
+        memory_instance.transposition_table.store(batch[i].key, batch[i].action_probs, batch[i].value);
+    }
+}
@@ -0,0 +1,36 @@
+#include <torch/torch.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "chess/chess.hpp"
+#include "evaluator.h"
+#include "model.h"
+
+
+#ifndef MODEL_EVALUATOR_H
+#define MODEL_EVALUATOR_H
+
+// Runs the network on the calling thread, the whole batch in one forward pass,
+// instead of queueing the positions for the inference server. The lock-step
+// driver uses it so every round of its games is exactly one network batch.
+// Probes and results go through the transposition table of memory, like
+// memory_evaluator_t.
+class model_evaluator_t : public memory_evaluator_t
+{
+public:
+    explicit model_evaluator_t(std::shared_ptr<LCZero> model);
+    void evaluate(std::vector<evaluation_t>& batch) override;
+
+    // forward passes run so far, the positions they evaluated and the seconds they took
+    uint64_t batches() const { return num_batches; }
+    uint64_t positions() const { return num_positions; }
+    double seconds() const { return total_seconds; }
+
+private:
+    std::shared_ptr<LCZero> model;
+    uint64_t num_batches = 0;
+    uint64_t num_positions = 0;
+    double total_seconds = 0;
+};
+
+#endif // MODEL_EVALUATOR_H
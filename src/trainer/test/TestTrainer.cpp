@@ -3,6 +3,10 @@
 #include "trainer.h"
 #include <gtest/gtest.h>
 #include "config.h"
+#include "inference_queue.h"
+#include "batch_tuner.h"
+#include <chrono>
+#include <thread>
 
 using namespace config;
 
@@ -20,4 +24,93 @@ TEST(TestTrainer, TestSelfPlay) {
     config.mcts_config.num_simulations = 100;
     Trainer trainer(config);
     trainer.self_play(0);
-}
\ No newline at end of file
+}
+TEST(TestInferenceQueue, TestSameKeySharesRequest) {
+    inference_queue_t queue;
+    chess::Board board;
+    chess::Movelist moves;
+    chess::movegen::legalmoves(moves, board);
+    auto first = queue.submit(board.hash(), board.getFen(), moves);
+    auto second = queue.submit(board.hash(), board.getFen(), moves);
+    ASSERT_EQ(queue.size(), 1);
+
+    std::stop_source stop;
+    auto batch = queue.take_batch(8, std::chrono::microseconds(100), stop.get_token());
+    ASSERT_EQ(batch.size(), 1);
+    queue.complete(batch[0], {{{moves[0], 1.0f}}, 0.5f});
+    ASSERT_EQ(first.get().value, 0.5f);
+    ASSERT_EQ(second.get().action_probs.size(), 1);
+
+    // answered positions are queued again
+    queue.submit(board.hash(), board.getFen(), moves);
+    ASSERT_EQ(queue.size(), 1);
+}
+
+TEST(TestInferenceQueue, TestTakeBatchReturnsFullBatchOrAfterMaxWait) {
+    inference_queue_t queue;
+    chess::Board board;
+    chess::Movelist moves;
+    chess::movegen::legalmoves(moves, board);
+    for (int i = 0; i < moves.size(); ++i) {
+        board.makeMove(moves[i]);
+        queue.submit(board.hash(), board.getFen(), {});
+        board.unmakeMove(moves[i]);
+    }
+
+    std::stop_source stop;
+    // a full batch is taken without waiting
+    auto start = std::chrono::steady_clock::now();
+    auto batch = queue.take_batch(8, std::chrono::seconds(10), stop.get_token());
+    ASSERT_EQ(batch.size(), 8);
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+
+    // the rest is taken once max_wait has passed
+    batch = queue.take_batch(64, std::chrono::milliseconds(20), stop.get_token());
+    ASSERT_EQ(batch.size(), moves.size() - 8);
+    ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+}
+
+TEST(TestInferenceQueue, TestStopWakesTakeBatch) {
+    inference_queue_t queue;
+    std::stop_source stop;
+    std::thread stopper([&stop]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        stop.request_stop();
+    });
+    auto batch = queue.take_batch(8, std::chrono::microseconds(100), stop.get_token());
+    stopper.join();
+    ASSERT_TRUE(batch.empty());
+}
+
+TEST(TestBatchTuner, TestTriesEveryBatchSizeThenPicksFastest) {
+    batch_tuner_t tuner(16, true, 4);
+    auto curve = tuner.curve();
+    ASSERT_EQ(curve.size(), 5);
+    ASSERT_EQ(curve.back().batch_size, 16);
+
+    // throughput peaks at a batch size of 4
+    auto seconds = [](size_t batch_size) { return batch_size == 4 ? 0.001f : 0.01f; };
+    for (size_t i = 0; i < curve.size(); ++i) {
+        auto batch_size = tuner.next_batch_size();
+        ASSERT_EQ(batch_size, curve[i].batch_size);
+        tuner.record(batch_size, batch_size, seconds(batch_size));
+    }
+    ASSERT_EQ(tuner.best_batch_size(), 4);
+
+    // every fourth batch tries a neighbour of the best size
+    std::vector<size_t> chosen;
+    for (int i = 0; i < 8; ++i) {
+        auto batch_size = tuner.next_batch_size();
+        chosen.push_back(batch_size);
+        tuner.record(batch_size, batch_size, seconds(batch_size));
+    }
+    ASSERT_EQ(chosen, (std::vector<size_t>{4, 4, 4, 2, 4, 4, 4, 8}));
+    ASSERT_EQ(tuner.best_batch_size(), 4);
+}
+
+TEST(TestBatchTuner, TestFixedBatchSize) {
+    batch_tuner_t tuner(100, false);
+    ASSERT_EQ(tuner.next_batch_size(), 100);
+    tuner.record(100, 10, 1.0f);
+    ASSERT_EQ(tuner.next_batch_size(), 100);
+}
@@ -1,128 +1,65 @@
 
 
 #include "trainer.h"
+#include <algorithm>
+#include <iterator>
+#include <tuple>
 #include "node.h"
 #include "mcts.h"
 #include "model.h"
 #include "string_utils.h"
 #include "thread_pool.h"
-#include "game_report.h"
-
-
-Trainer::Trainer(const config::Config& config) : config(config.trainer_config) {
+#include "model_evaluator.h"
+#include "random.h"
+
+
+Trainer::Trainer(const config::Config& config) :
+    _mcts_config(config.mcts_config),
+    _network_config(config.network_config),
+    _batch_tuner(
+        config.trainer_config.self_play_config.inference_batch_size,
+        config.trainer_config.self_play_config.adaptive_batch_size
+    ),
+    config(config.trainer_config) {
     Logger::log("Trainer constructor");
     _model = std::make_shared<LCZero>(config.network_config);
-    _model->to(torch::kCUDA);
+    if (config.network_config.cpu_threads > 0) {
+        at::set_num_threads(config.network_config.cpu_threads);
+    }
     _model->eval();
     _optimizer = std::make_shared<torch::optim::Adam>(_model->parameters(), torch::optim::AdamOptions(0.001));
     Logger::log("Model created");
-    _mcts = std::make_shared<MCTS>(_model, config.mcts_config);
+    {
+        std::unique_lock<std::mutex> lock(memory::getInstance().transposition_table_mutex);
+        memory::getInstance().transposition_table.resize(config.mcts_config.transposition_table_bytes);
+    }
     // auto dataset = ChessDataSet(1000000).map(torch::data::transforms::Stack<>());
     // _dataset = ChessDataSet(1000000).map(torch::data::transforms::Stack<>());
     
 
-    model_thread = std::thread([this]() {
-        while (true) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            // if (!_self_playing) {
-            //     Logger::log("Waiting forself play");
-             //    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-            //     continue;
-            // }
-            torch::Tensor input_tensor;
-            
-            {
-                std::unique_lock<std::mutex> lock(memory::getInstance().boards_to_compute_and_processing_mutex);
-                if (memory::getInstance().boards_to_compute.size() == 0) {
-                    continue;
-                }
-                memory::getInstance().processing = memory::getInstance().boards_to_compute;
-                // Logger::log("Processing " + std::to_string(memory::getInstance().processing.size()) + " boards");
-                input_tensor = torch::zeros({static_cast<long>(memory::getInstance().boards_to_compute.size()), 19, 8, 8});
-                // Logger::log("Transforming boards to tensor");
-                for (int i = 0; i < memory::getInstance().boards_to_compute.size(); i++) {
-                    auto board = chess::Board(memory::getInstance().boards_to_compute[i]);
-                    input_tensor[i] = utils::board_to_tensor(board);
-                }
-                // Logger::log("Tensor created");
-                memory::getInstance().boards_to_compute.clear();
-            }
-            if (input_tensor.sizes()[0] == 0) {
-                Logger::log("No boards to compute");
-                continue;
-            }
-            // Logger::log("Computing action probabilities for " + std::to_string(input_tensor.sizes()[0]) + " boards");
-            auto output = _model->forward(input_tensor);
-            auto policy_tensor = std::get<0>(output).to(torch::kCPU);
-            auto value_tensor = std::get<1>(output).to(torch::kCPU);
-
-            // Logger::log("Model called");
-
-            auto tmp_action_probs_map = std::unordered_map<std::string, std::pair<node_t::action_probs_t, float>>();
-
-            for (int i = 0; i < memory::getInstance().processing.size(); i++) {
-                auto fen_without_fullmove = memory::getInstance().processing[i];
-                auto board = chess::Board(fen_without_fullmove + " 0");
-                auto action_probs = std::vector<std::pair<chess::Move, float>>();
-                auto legal_moves = chess::Movelist();
-                chess::movegen::legalmoves(legal_moves, board);
-
-                for (auto move : legal_moves) {
-                    auto idx = utils::move_to_idx(move);
-                    action_probs.push_back(std::make_pair(move, policy_tensor[i][idx].item<float>()));
-                }
-
-                auto legal_action_probs = std::vector<float>();
-                for (auto move : legal_moves) {
-                    auto idx = utils::move_to_idx(move);
-                    legal_action_probs.push_back(policy_tensor[i][idx].item<float>());
-                }
-
-                auto valid_action_probs_tensor = torch::tensor(legal_action_probs)
-                    .view({1, static_cast<long>(legal_action_probs.size())});
-                auto action_probs_tensor = torch::nn::functional::softmax(
-                    valid_action_probs_tensor,
-                    torch::nn::functional::SoftmaxFuncOptions(1).dtype(torch::kFloat32)
-                );
-
-                for (int j = 0; j < action_probs.size(); j++) {
-                    action_probs[j].second = action_probs_tensor[0][j].item<float>();
-                }
-                tmp_action_probs_map[fen_without_fullmove] = std::make_pair(std::move(action_probs), value_tensor[i].item<float>());
-            }
-            // Logger::log("Between");
-
-            {   
-                // Logger::log("Waiting for action_probs_map_mutex");
-                std::unique_lock<std::mutex> lock(memory::getInstance().action_probs_map_mutex);
-                // Logger::log("Muterx locked");
-                for (auto& item : tmp_action_probs_map) {
-                    memory::getInstance().action_probs_map[item.first] = item.second;
-                }
-                // Logger::log("Mutex unlocked");
-            }
-
-            /*{
-                std::unique_lock<std::mutex> lock(memory::getInstance().action_probs_map_mutex);
-                Logger::log("Action probs map size: " + std::to_string(memory::getInstance().action_probs_map.size()));
-            }*/
-
-            {
-                // Logger::log("Waiting for boards_to_compute_and_processing_mutex");
-                std::unique_lock<std::mutex> lock(memory::getInstance().boards_to_compute_and_processing_mutex);
-                memory::getInstance().processing.clear();
-                // Logger::log("Processing cleared");
-            }
-        }
-    });
-    model_thread.detach();
+    export_inference_model();
+    _inference_server = std::make_unique<inference_server_t>(
+        _inference_model,
+        memory::getInstance().inference_queue,
+        _batch_tuner,
+        config.trainer_config.self_play_config
+    );
 }
 
 void Trainer::self_play(int iteration) {
     _self_playing = true;
     _dataset.clear();
+    _positions = 0;
+    _masked_positions = 0;
+    // train() leaves the batch norms in training mode
+    _model->eval();
 
     auto& trainer_config = config.self_play_config;
+    if (trainer_config.lockstep_games > 0) {
+        self_play_lockstep(iteration);
+        log_policy_targets();
+        return;
+    }
     ThreadPool pool(trainer_config.max_threads);
     
 
@@ -136,72 +73,182 @@ void Trainer::self_play(int iteration) {
     }
 
     pool.wait();
+    log_inference_stats();
+    log_policy_targets();
 
     // save dataset
 }
 
-void Trainer::play_game(int iteration, int game) {
-    chess::Board board;
-    _self_playing = false;
-    std::vector<ChessData> history;
-    GameReport game_report;
-    while (true) {
-        Logger::log("Cache size: " + std::to_string(memory::getInstance().action_probs_map.size()));
-        Logger::log("Current Board: " + board.getFen());
-        auto root = _mcts->search(board, iteration);
-        // Logger::log("Search");
-        auto action = root->get_action();
-        // Logger::log("Action: " + to_string(action));
-        
-        history.push_back(ChessData{board.getFen(), root->get_action_probs_tensor(), torch::zeros({1})});
-        
-        MoveReport move_report;
-        move_report.fen = board.getFen();
-        
-        board.makeMove(action);
-
-        // Report the move
-        move_report.move = to_string(action);
-        auto action_probs = root->get_action_probs();
-        auto children = root->get_children();
-        for (int i = 0; i <action_probs.size(); ++i) {
-            move_report.children.push_back({to_string(action_probs[i].first), action_probs[i].second, children[i]->get_value(), children[i]->get_visit_count(), children[i]->get_prior()});
-        }
+void Trainer::log_inference_stats() const {
+    std::string curve;
+    for (auto& bucket : _batch_tuner.curve()) {
+        curve += " " + std::to_string(bucket.batch_size) + ":" + std::to_string(static_cast<int>(bucket.positions_per_second));
+    }
+    Logger::log("Inference batch size: " + std::to_string(_batch_tuner.best_batch_size()) + ", positions/s by batch size:" + curve);
+}
 
-        move_report.value = root->get_value();
-        game_report.moves.push_back(move_report);
+void Trainer::log_policy_targets() const {
+    int positions = _positions;
+    int masked = _masked_positions;
+    float share = positions > 0 ? 100.0f * masked / positions : 0.0f;
+    Logger::log("Positions without a policy target: " + std::to_string(masked) + " of " + std::to_string(positions) + " (" + std::to_string(share) + "%)");
+}
 
-        if (board.isGameOver().second != chess::GameResult::NONE) {
-            float result = 0;
-            if (board.isGameOver().second != chess::GameResult::DRAW) {
-                result = (board.isGameOver().second == chess::GameResult::LOSE) == 
-                         (board.sideToMove() == chess::Color::BLACK) ? 1 : -1;   // if true white wins
-            }
+void Trainer::self_play_lockstep(int iteration) {
+    auto& trainer_config = config.self_play_config;
+    // one forward pass per round, the batch is the leaves of every game, not a size picked by the tuner
+    model_evaluator_t evaluator(_inference_model);
+
+    int started = 0;
+    auto new_game = [&]() {
+        auto game = std::make_unique<self_play_game_t>();
+        game->index = started++;
+        // every game owns its search tree
+        game->mcts = std::make_unique<MCTS>(_inference_model, _mcts_config);
+        Logger::log("Game " + std::to_string(game->index));
+        return game;
+    };
+    std::vector<std::unique_ptr<self_play_game_t>> games;
+    while (started < trainer_config.num_games_per_iteration && static_cast<int>(games.size()) < trainer_config.lockstep_games) {
+        games.push_back(new_game());
+    }
 
-            if (result == 1) {
-                Logger::log("White won");
-            } else if (result == -1) {
-                Logger::log("Black won");
-            } else {
-                Logger::log("Draw");
+    // the leaves of every game, and where the leaves of each game start in it
+    std::vector<evaluation_t> batch;
+    std::vector<std::tuple<MCTS*, std::vector<evaluation_t>*, size_t>> gathered;
+    while (!games.empty()) {
+        batch.clear();
+        gathered.clear();
+        for (size_t i = 0; i < games.size();) {
+            auto& game = *games[i];
+            auto& mcts = *game.mcts;
+            if (!game.searching) {
+                // playout cap randomization, most moves only get a fast search
+                game.full_search = _mcts_config.fast_simulations <= 0 || utils::random_bool(_mcts_config.full_search_probability);
+                mcts.begin_search(game.board, iteration, game.full_search);
+                game.searching = true;
             }
-
-            for (auto& item : history) {
-                item.value += result;
-                result = -result;
+            if (mcts.search_done()) {
+                game.searching = false;
+                if (play_move(game, mcts.end_search())) {
+                    finish_game(game, iteration);
+                    if (started < trainer_config.num_games_per_iteration) {
+                        games[i] = new_game();
+                    } else {
+                        games.erase(games.begin() + i);
+                    }
+                }
+                // the next search of the slot starts in the same round
+                continue;
             }
-            
+            auto& leaves = mcts.gather_batch();
+            gathered.emplace_back(&mcts, &leaves, batch.size());
+            std::move(leaves.begin(), leaves.end(), std::back_inserter(batch));
+            ++i;
+        }
+
+        if (!batch.empty()) {
+            evaluator.evaluate(batch);
+        }
+        for (auto& [mcts, leaves, offset] : gathered) {
+            std::move(batch.begin() + offset, batch.begin() + offset + leaves->size(), leaves->begin());
+            mcts->apply_batch();
+        }
+    }
+    double positions = static_cast<double>(evaluator.positions());
+    Logger::log("Lock-step inference: " + std::to_string(evaluator.batches()) + " forward passes, "
+        + std::to_string(static_cast<int>(positions / std::max<uint64_t>(1, evaluator.batches()))) + " positions per pass, "
+        + std::to_string(static_cast<int>(positions / std::max(evaluator.seconds(), 1e-9))) + " positions/s");
+}
+
+void Trainer::play_game(int iteration, int game_index) {
+    self_play_game_t game;
+    game.index = game_index;
+    // every game owns its search tree
+    game.mcts = std::make_unique<MCTS>(_inference_model, _mcts_config);
+    _self_playing = false;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(memory::getInstance().transposition_table_mutex);
+            Logger::log("Cache size: " + std::to_string(memory::getInstance().transposition_table.size()));
+        }
+        Logger::log("Current Board: " + game.board.getFen());
+        // playout cap randomization, most moves only get a fast search
+        game.full_search = _mcts_config.fast_simulations <= 0 || utils::random_bool(_mcts_config.full_search_probability);
+        auto& tree = game.mcts->search(game.board, iteration, game.full_search);
+        if (play_move(game, tree)) {
             break;
         }
     }
+    finish_game(game, iteration);
+}
+
+bool Trainer::play_move(self_play_game_t& game, search_tree_t& tree) {
+    auto& board = game.board;
+    auto action = tree.get_action();
+    // Logger::log("Action: " + to_string(action));
+    
+    game.history.push_back(ChessData{board.getFen(), tree.get_action_probs_tensor(), torch::zeros({1}), game.full_search});
+    
+    MoveReport move_report;
+    move_report.fen = board.getFen();
+    
+    board.makeMove(action);
+
+    // Report the move
+    move_report.move = to_string(action);
+    auto action_probs = tree.get_action_probs();
+    auto first_edge = tree[tree.root()].first_edge;
+    for (int i = 0; i <action_probs.size(); ++i) {
+        auto edge = first_edge + i;
+        move_report.children.push_back({to_string(action_probs[i].first), action_probs[i].second, tree.edges.values[edge], tree.edges.visits[edge], tree.edges.priors[edge]});
+    }
+
+    move_report.value = tree[tree.root()].get_value();
+    move_report.simulations = game.mcts->last_search_stats().simulations;
+    move_report.saved_simulations = game.mcts->last_search_stats().saved_simulations;
+    move_report.full_search = game.full_search;
+    game.report.moves.push_back(move_report);
+
+    // keeps the subtree of the played move for the next search
+    game.mcts->advance(action);
+
+    if (board.isGameOver().second == chess::GameResult::NONE) {
+        return false;
+    }
+    float result = 0;
+    if (board.isGameOver().second != chess::GameResult::DRAW) {
+        result = (board.isGameOver().second == chess::GameResult::LOSE) == 
+                 (board.sideToMove() == chess::Color::BLACK) ? 1 : -1;   // if true white wins
+    }
 
-    _dataset.add_data(history);
-    auto game_result = board.isGameOver();
-    game_report.result = game_result.second == chess::GameResult::DRAW ? "1/2 - 1/2" : (board.sideToMove() == chess::Color::WHITE ? "0-1" : "1-0");
+    if (result == 1) {
+        Logger::log("White won");
+    } else if (result == -1) {
+        Logger::log("Black won");
+    } else {
+        Logger::log("Draw");
+    }
+
+    for (auto& item : game.history) {
+        item.value += result;
+        result = -result;
+    }
+    return true;
+}
+
+void Trainer::finish_game(self_play_game_t& game, int iteration) {
+    _positions += static_cast<int>(game.history.size());
+    for (auto& item : game.history) {
+        _masked_positions += item.full_search ? 0 : 1;
+    }
+    _dataset.add_data(game.history);
+    auto game_result = game.board.isGameOver();
+    game.report.result = game_result.second == chess::GameResult::DRAW ? "1/2 - 1/2" : (game.board.sideToMove() == chess::Color::WHITE ? "0-1" : "1-0");
     if (config.report_path.empty()) {
         return;
     }
-    game_report.save(config.report_path + "/game_report_" + std::to_string(iteration) + "_" + std::to_string(game) + ".json");
+    game.report.save(config.report_path + "/game_report_" + std::to_string(iteration) + "_" + std::to_string(game.index) + ".json");
 
 }
 
@@ -209,8 +256,7 @@ void Trainer::load_model(const std::string& path) {
     torch::serialize::InputArchive archive;
     archive.load_from(path);
     _model->load(archive);
-
-    _mcts->set_model(_model);
+    export_inference_model();
 }
 
 void Trainer::save_model(const std::string& path) {
@@ -222,13 +268,14 @@ void Trainer::save_model(const std::string& path) {
 
 void Trainer::set_model(std::shared_ptr<LCZero> model) {
     _model = model;
-    _mcts->set_model(model);
+    export_inference_model();
 }
 
 void Trainer::train() {
     Logger::log("Training");
     _model->train();
     auto& trainer_config = config.training_config;
+    auto device = _model->device();
     if (!_dataset.size().has_value()) {
         Logger::log("Dataset has no data");
         return;
@@ -249,19 +296,25 @@ void Trainer::train() {
             batch_count++;
             
             torch::Tensor input, policy_target, value_target;
-            input = batch.input.to(torch::kCUDA);
-            policy_target = batch.policy.to(torch::kCUDA);
-            value_target = batch.value.view({-1}).to(torch::kCUDA);
+            input = batch.input.to(device);
+            policy_target = batch.policy.to(device);
+            value_target = batch.value.view({-1}).to(device);
+            auto policy_mask = batch.policy_mask.view({-1}).to(device);
 
             auto output = _model->forward(input);
-            auto policy_output = std::get<0>(output).to(torch::kCUDA);
-            auto value_output = std::get<1>(output).to(torch::kCUDA).view({-1});
+            auto policy_output = std::get<0>(output);
+            auto value_output = std::get<1>(output).view({-1});
 
             auto log_probs = torch::log_softmax(policy_output, 1);
             
             
-            auto criterion = torch::nn::KLDivLoss(torch::nn::KLDivLossOptions(torch::kBatchMean));
-            auto policy_loss = criterion(log_probs, policy_target);
+            // only positions of a full search are policy targets
+            auto policy_kl = torch::nn::functional::kl_div(
+                log_probs,
+                policy_target,
+                torch::nn::functional::KLDivFuncOptions().reduction(torch::kNone)
+            ).sum(1);
+            auto policy_loss = (policy_kl * policy_mask).sum() / policy_mask.sum().clamp_min(1);
 
             auto value_loss = torch::nn::functional::mse_loss(value_output, value_target);
             auto loss = policy_loss + value_loss;
@@ -277,6 +330,23 @@ void Trainer::train() {
     }
     save_model("model.pt");
     Logger::log("Model saved");
+    export_inference_model();
+}
+
+void Trainer::export_inference_model() {
+    _model->eval();
+    if (_network_config.fold_batch_norm) {
+        auto inference_model = std::make_shared<LCZero>(_network_config);
+        inference_model->load_folded(*_model);
+        inference_model->to(_model->device());
+        inference_model->eval();
+        _inference_model = inference_model;
+    } else {
+        _inference_model = _model;
+    }
+    if (_inference_server) {
+        _inference_server->set_model(_inference_model);
+    }
 }
 
 void Trainer::save_dataset(const std::string& path) {
@@ -1,14 +1,31 @@
 
 #include <torch/torch.h>
+#include <atomic>
 #include <memory>
 #include "model.h"
 #include "mcts.h"
 #include "memory.h"
 #include "dataset.h"
+#include "game_report.h"
+#include "batch_tuner.h"
+#include "inference_server.h"
 
 #ifndef TRAINER_H
 #define TRAINER_H
 
+// A self play game in progress, its search and the training data it produced so far.
+struct self_play_game_t
+{
+    int index = 0;
+    chess::Board board;
+    std::unique_ptr<MCTS> mcts;
+    std::vector<ChessData> history;
+    GameReport report;
+    bool full_search = true;
+    // between begin_search() and end_search() of the lock-step driver
+    bool searching = false;
+};
+
 class Trainer {
 public:
     Trainer(const config::Config& config);
@@ -16,21 +33,42 @@ public:
     void train();
     void play_game(int iteration, int game);
     void self_play(int iteration);
+    // plays lockstep_games games at once on the calling thread, one network batch per round
+    void self_play_lockstep(int iteration);
     void load_model(const std::string& path);
     void save_model(const std::string& path);
     void set_model(std::shared_ptr<LCZero> model);
+    // refreshes the model self play runs from the trained one, with the batch norms folded when fold_batch_norm is set
+    void export_inference_model();
     void save_dataset(const std::string& path);
     void load_dataset(const std::string& path);
+    // the batch sizes tried by the model thread and their throughput
+    const batch_tuner_t& batch_tuner() const { return _batch_tuner; }
 
 
 private:
+    // plays the move chosen by the search, true once the game is over
+    bool play_move(self_play_game_t& game, search_tree_t& tree);
+    void finish_game(self_play_game_t& game, int iteration);
+    void log_inference_stats() const;
+    // how many self play positions the policy loss masks, the fast searches of playout cap randomization
+    void log_policy_targets() const;
+
     std::shared_ptr<LCZero> _model;
-    std::shared_ptr<MCTS> _mcts;
-    std::thread model_thread;
+    // the model of self play, exported from _model after every training
+    std::shared_ptr<LCZero> _inference_model;
+    config::Config::MCTSConfig _mcts_config;
+    config::Config::NetworkConfig _network_config;
+    batch_tuner_t _batch_tuner;
+    // answers the positions of memory's inference queue, stopped with the trainer
+    std::unique_ptr<inference_server_t> _inference_server;
     config::Config::TrainerConfig config;
     ChessDataSet _dataset;
     std::shared_ptr<torch::optim::Adam> _optimizer;
     bool _self_playing = false;
+    // positions of the finished games of the current self play, and those without a policy target
+    std::atomic<int> _positions = 0;
+    std::atomic<int> _masked_positions = 0;
 };
 
 #endif // TRAINER_H
\ No newline at end of file
@@ -1,6 +1,7 @@
 
 
 #include "board_utils.h"
+#include <atomic>
 #include <cmath>
 #include "logger.h"
 #include "node.h"
@@ -8,6 +9,15 @@
 
 namespace utils{
 
+#ifdef MOVEGEN_STATS
+namespace {
+
+// constant initialized and trivially destructible, safe to use from any thread until exit
+std::atomic<uint64_t> movegen_calls{0};
+
+} // namespace
+#endif
+
 torch::Tensor board_to_tensor(chess::Board& board) {
     torch::Tensor tensor = torch::zeros({19, 8, 8});
 
@@ -143,4 +153,17 @@ std::optional<chess::Move> idx_to_move(int idx) {
     );
 }   
 
+void legal_moves(chess::Movelist& moves, const chess::Board& board) {
+#ifdef MOVEGEN_STATS
+    movegen_calls.fetch_add(1, std::memory_order_relaxed);
+#endif
+    chess::movegen::legalmoves(moves, board);
+}
+
+#ifdef MOVEGEN_STATS
+uint64_t movegen_count() {
+    return movegen_calls.load(std::memory_order_relaxed);
+}
+#endif
+
 } // namespace utils
\ No newline at end of file
@@ -1,5 +1,6 @@
 
 #include <torch/torch.h>
+#include <cstdint>
 #include <memory>
 #include <vector>
 
@@ -14,6 +15,13 @@ namespace utils{
 torch::Tensor board_to_tensor(chess::Board& board);
 int move_to_idx(chess::Move move);
 std::optional<chess::Move> idx_to_move(int idx);
+// Legal move generation of the search. Builds configured with MOVEGEN_STATS
+// count the calls, so the benchmarks can report move generations per simulation.
+void legal_moves(chess::Movelist& moves, const chess::Board& board);
+#ifdef MOVEGEN_STATS
+// legal_moves calls of the whole process so far
+uint64_t movegen_count();
+#endif
 
 } // namespace utils
 
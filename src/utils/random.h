@@ -1,15 +1,32 @@
 
 #include <vector>
 #include <utility>
+#include <cmath>
+#include <limits>
 #include <random>
 
 namespace utils{
 
-int random_choose(std::vector<float>& probs) {
+inline int random_choose(std::vector<float>& probs) {
     std::random_device rd;
     std::mt19937 gen(rd());
     std::discrete_distribution<> d(probs.begin(), probs.end());
     return d(gen);
 }
 
+// a sample of the standard Gumbel distribution
+inline float random_gumbel() {
+    static thread_local std::mt19937 gen(std::random_device{}());
+    // open interval, so neither log sees 0
+    std::uniform_real_distribution<float> d(std::numeric_limits<float>::min(), 1.0f);
+    return -std::log(-std::log(d(gen)));
+}
+
+// true with the given probability
+inline bool random_bool(float probability) {
+    static thread_local std::mt19937 gen(std::random_device{}());
+    std::bernoulli_distribution d(probability);
+    return d(gen);
+}
+
 }
\ No newline at end of file
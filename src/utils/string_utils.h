@@ -100,18 +100,26 @@ std::string join_str(const std::string& sep, Head&& head, Tail&&... tail) {
 }
 
 
-inline std::string to_string(const node_t& node, int tab_count = 0) {
+inline std::string to_string(const search_tree_t& tree, node_index_t index = 0, int tab_count = 0) {
+    auto& node = tree[index];
+    chess::Move move = node.parent_edge == NULL_EDGE ? chess::Move(0) : tree.edges.moves[node.parent_edge];
     std::string res = join_str
-        (" ", std::string(tab_count, '\t'), "Node", node.move.from(), node.move.to(), "Value", node.value, "Visit Count", node.visit_count);
-    for (const auto& child : node.children) {
+        (" ", std::string(tab_count, '\t'), "Node", move.from(), move.to(), "Value", node.value, "Visit Count", node.visit_count);
+    for (edge_index_t edge = node.first_edge; edge < node.first_edge + node.num_edges; ++edge) {
         res += "\n";
         for (int i = 0; i < tab_count + 1; ++i) {
             res += "\t";
         }
-        res += to_string(*child, tab_count + 1);
+        // in graph mode a shared node is printed under the edge it was first reached by
+        if (tree.edges.children[edge] != NULL_NODE && tree[tree.edges.children[edge]].parent_edge == edge) {
+            res += to_string(tree, tree.edges.children[edge], tab_count + 1);
+        } else {
+            res += join_str(" ", std::string(tab_count + 1, '\t'), "Node", tree.edges.moves[edge].from(), tree.edges.moves[edge].to(), "Value", tree.edges.values[edge], "Visit Count", tree.edges.visits[edge]);
+        }
     }
     return res;
 }
+
 // Split like python
 inline std::vector<std::string> split(std::string str, const std::string& delimiter) {
     std::vector<std::string> tokens;
@@ -9,4 +9,23 @@ TEST(TestRandom, TestRandomChoose) {
     int chosen_index = random_choose(probs);
     ASSERT_GE(chosen_index, 0);
     ASSERT_LT(chosen_index, probs.size());
-}
\ No newline at end of file
+}
+TEST(TestRandom, TestRandomBool) {
+    ASSERT_TRUE(random_bool(1.0));
+    ASSERT_FALSE(random_bool(0.0));
+    int hits = 0;
+    for (int i = 0; i < 10000; ++i) {
+        hits += random_bool(0.25);
+    }
+    ASSERT_NEAR(hits, 2500, 300);
+}
+TEST(TestRandom, TestRandomGumbel) {
+    double sum = 0;
+    for (int i = 0; i < 10000; ++i) {
+        float sample = random_gumbel();
+        ASSERT_TRUE(std::isfinite(sample));
+        sum += sample;
+    }
+    // the mean of the standard Gumbel distribution is the Euler-Mascheroni constant
+    ASSERT_NEAR(sum / 10000, 0.5772, 0.05);
+}